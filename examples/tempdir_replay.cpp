@@ -0,0 +1,76 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+// Replays a trace recorded with TraceRecorder against another configuration.
+//
+//   tempdir_replay <trace> [--root <path>] [--session] [--keep] [--speed <factor>] [--no-timing]
+
+#include <bw/tempdir/tempdir_replay.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace bw::tempdir;
+
+namespace
+{
+int usage()
+{
+    std::fprintf(stderr, "usage: tempdir_replay <trace> [--root <path>] [--session] [--keep] "
+                         "[--speed <factor>] [--no-timing]\n");
+    return 2;
+}
+
+double ms(std::uint64_t ns) { return double(ns) / 1e6; }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+        return usage();
+
+    ReplayOptions options;
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--root" && i + 1 < argc)
+            options.config.set_root_path(argv[++i]);
+        else if (arg == "--session")
+            options.config.set_session(true);
+        else if (arg == "--keep")
+            options.config.set_cleanup(Cleanup::never);
+        else if (arg == "--speed" && i + 1 < argc)
+            options.set_speed(std::atof(argv[++i]));
+        else if (arg == "--no-timing")
+            options.set_timing(false);
+        else
+            return usage();
+    }
+
+    try
+    {
+        auto events = TraceRecorder::read(argv[1]);
+        ReplayResult result = replay_trace(events, options);
+
+        std::printf("%zu events, %zu threads, %.3f ms wall time\n", result.events, result.threads,
+                    ms(result.wall_ns));
+        std::printf("%-16s %8s %14s %14s\n", "operation", "events", "recorded ms", "replayed ms");
+        for (std::size_t op = 0; op < result.ops.size(); ++op)
+        {
+            const auto& stats = result.ops[op];
+            if (stats.events)
+                std::printf("%-16s %8zu %14.3f %14.3f\n", trace_op_name(TraceOp(op)),
+                            stats.events, ms(stats.recorded_ns), ms(stats.replayed_ns));
+        }
+        for (const auto& error : result.errors)
+            std::fprintf(stderr, "error: %s\n", error.c_str());
+        return result.errors.empty() ? 0 : 1;
+    }
+    catch (const std::exception& ex)
+    {
+        std::fprintf(stderr, "error: %s\n", ex.what());
+        return 1;
+    }
+}
@@ -4,19 +4,41 @@
 
 #pragma once
 
-#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <exception>
 #include <filesystem>
 #include <functional>
-#include <iostream>
-#include <random>
+#include <initializer_list>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <vector>
+
+// TempDir can be used header-only (default) or as compiled library. When TD_COMPILED_LIBRARY is
+// defined, this header only provides declarations and the implementation is compiled once into
+// the tempdir_compiled library (see src/tempdir.cpp), which keeps heavy standard and platform
+// headers out of the including translation units.
+#ifdef TD_COMPILED_LIBRARY
+#define TD_INLINE
+#else
+#define TD_INLINE inline
+#endif
+
+// __builtin_FILE and __builtin_LINE evaluated in default arguments yield the location of the
+// caller, which allows to capture call sites without macros and without std::source_location.
+#if defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1927)
+#define TD_HAS_BUILTIN_CALL_SITE 1
+#endif
 
 namespace bw::tempdir
 {
 namespace fs = std::filesystem;
 
 // Default log implementation used by Config struct
-inline void log(const std::string& message) { std::cout << message << std::endl; }
+TD_INLINE void log(const std::string& message);
 
 // Exception class for errors related to TempDir operations.
 // E.g. for issues encountered during the creation, usage, or deletion of temporary directories.
@@ -42,6 +64,122 @@ enum class Cleanup
     never       // Never clean up a temporary directory after TempDir goes out of scope.
 };
 
+// CleanupStrategy selects how the contents of a temporary directory are removed.
+enum class CleanupStrategy
+{
+    serial,   // Remove all entries on the calling thread.
+    parallel, // Remove entries on all hardware threads.
+    deferred, // Rename the directory aside and remove it in the background.
+    adaptive  // Choose one of the above by the estimated tree size and the filesystem.
+};
+
+// struct holding the source location a TempDir was created from
+// Only a pointer to the static file name string and the line are stored.
+struct CallSite
+{
+    const char* file = "unknown";
+    unsigned int line = 0;
+
+    // Returns the call site of the caller when used as default argument.
+#ifdef TD_HAS_BUILTIN_CALL_SITE
+    static constexpr CallSite current(const char* file = __builtin_FILE(),
+                                      unsigned int line = __builtin_LINE())
+#else
+    static constexpr CallSite current(const char* file = "unknown", unsigned int line = 0)
+#endif
+    {
+        return CallSite{file, line};
+    }
+};
+
+// struct describing a TempDir operation that exceeded Config::slow_operation_threshold_us
+struct SlowOperation
+{
+    const char* operation = "";           // "create" or "cleanup"
+    CallSite call_site;                   // call site the TempDir was created from
+    fs::path path;                        // temporary directory
+    std::uint64_t total_us = 0;           // duration of the whole operation
+    std::uint64_t name_generation_us = 0; // create: generating the name, resolving the parent
+    std::uint64_t mkdir_us = 0;           // create: creating the directory
+    std::uint64_t removal_us = 0;         // cleanup: removing the tree
+    std::uintmax_t entries = 0;           // cleanup: number of removed entries
+};
+
+// struct describing the filesystem a root path is located on, see TempDir::inspect_root
+struct RootInfo
+{
+    fs::path path;
+    fs::path mount_point;         // empty if unknown
+    std::string filesystem;       // e.g. "ext4", "tmpfs" or "overlay", empty if unknown
+    bool container_layer = false; // overlayfs or aufs, writes are copied up into the container
+};
+
+// enum of operations recorded by TraceRecorder
+enum class TraceOp : std::uint8_t
+{
+    create,          // TempDir created
+    cleanup,         // TempDir removed, count = removed entries
+    write_files,     // count = files, bytes = content bytes
+    materialize,     // count = fixture nodes, bytes = content bytes
+    list,            // count = listed entries
+    prefetch,        // count = files, bytes = file bytes
+    cache_footprint, // count = inspected files, bytes = file bytes
+    verify           // count = fixture nodes, bytes = number of differences
+};
+
+// number of operations in TraceOp, verify must remain the last one
+constexpr std::size_t trace_op_count = static_cast<std::size_t>(TraceOp::verify) + 1;
+
+// struct holding one event of a TempDir operation trace
+struct TraceEvent
+{
+    std::uint64_t timestamp_ns = 0; // start of the operation, relative to the recorder start
+    std::uint64_t duration_ns = 0;
+    std::uint32_t thread = 0;       // small id of the calling thread, unique within the process
+    std::uint32_t dir = 0;          // id of the TempDir within the trace
+    TraceOp op = TraceOp::create;
+    std::uint64_t count = 0;
+    std::uint64_t bytes = 0;
+};
+
+// TraceRecorder records the lifecycle and file operations of TempDirs into a compact binary
+// trace file, to replay production workloads offline (see tempdir_replay.hpp).
+//
+// Recording is enabled per TempDir with Config::set_trace_recorder. Events are varint encoded
+// with delta timestamps, buffered in memory and appended to the file in chunks, the remaining
+// events are written when the recorder is destroyed. The recorder is thread-safe and has to
+// outlive all TempDirs recording into it.
+class TraceRecorder
+{
+  public:
+    // Creates or truncates the trace file. If an error occurs, a TempDirException is thrown.
+    explicit TraceRecorder(const fs::path& file);
+    ~TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // Returns the nanoseconds elapsed since the recorder was created.
+    std::uint64_t now_ns() const;
+
+    // Returns a new id for a TempDir recorded into this trace.
+    std::uint32_t next_dir_id();
+
+    // Appends an event to the trace.
+    void record(const TraceEvent& event);
+
+    // Writes all buffered events to the file. If an error occurs, a TempDirException is thrown.
+    void flush();
+
+    // Reads all events of a trace file. If the file is not a valid trace,
+    // a TempDirException is thrown.
+    static std::vector<TraceEvent> read(const fs::path& file);
+
+  private:
+    struct State;
+    std::unique_ptr<State> _state;
+};
+
 // struct holding configuration options for TempDir
 // It allows to specify the root path of temporary directory, the cleanup and logging behavior
 // as well as the temporary directory prefix.
@@ -51,6 +189,19 @@ struct Config
     Cleanup cleanup = Cleanup::always;
     std::string temp_dir_prefix = "temp_dir";
     std::function<void(const std::string&)> log_impl;
+    std::pmr::memory_resource* memory_resource = std::pmr::get_default_resource();
+    bool session = false;
+    std::uint64_t slow_operation_threshold_us = 0; // 0 = slow operations are not detected
+    std::function<void(const SlowOperation&)> slow_operation_handler;
+    TraceRecorder* trace_recorder = nullptr;
+    std::size_t generation_max_dirs = 0;     // 0 = no rotation by count
+    std::uint64_t generation_max_age_s = 0;  // 0 = no rotation by age
+    std::uint64_t cleanup_budget_us = 0;     // 0 = cleanup is not bounded by time
+    std::size_t cleanup_budget_entries = 0;  // 0 = cleanup is not bounded by entries
+    CleanupStrategy cleanup_strategy = CleanupStrategy::serial;
+    bool avoid_container_layer = false;
+    std::vector<fs::path> volume_roots;
+    fs::path migration_root; // empty = the TempDir is not migrated
 
     Config& set_root_path(const fs::path& root_path)
     {
@@ -70,6 +221,105 @@ struct Config
         return *this;
     }
 
+    // Sets the memory resource used for allocations made by TempDir and its helpers,
+    // e.g. a per-request std::pmr::monotonic_buffer_resource. The resource does not have to be
+    // thread-safe, allocations from parallel workers are serialized by TempDir.
+    Config& set_memory_resource(std::pmr::memory_resource* memory_resource)
+    {
+        this->memory_resource = memory_resource;
+        return *this;
+    }
+
+    // Enables session mode: all temporary directories of the process with the same root path
+    // and prefix are nested in one session directory root_path/<prefix>_session_<pid>_<start>_<ns>,
+    // created by the first TempDir. The session is removed as a whole at process exit, sessions
+    // of crashed processes are reaped when a new session is started (see TempDir::reap_sessions).
+    // Temporary directories with Cleanup::never are not nested, so they survive the session.
+    Config& set_session(bool session)
+    {
+        this->session = session;
+        return *this;
+    }
+
+    // Enables the detection of slow creations and cleanups taking at least the given number of
+    // microseconds. Slow operations are passed to the handler, or logged with call site and
+    // phase breakdown if no handler is given. Timing is only done while detection is enabled.
+    // The call site is only known for TempDirs created by TempDir::create, open_or_create,
+    // SharedTempDir::create_cross_process or attach; TempDirs constructed directly report
+    // SlowOperation::call_site with line 0 and are logged without "created at".
+    Config& set_slow_operation_threshold_us(
+        std::uint64_t threshold_us, std::function<void(const SlowOperation&)> handler = {})
+    {
+        this->slow_operation_threshold_us = threshold_us;
+        this->slow_operation_handler = handler;
+        return *this;
+    }
+
+    // Enables generation rotation of the root path: temporary directories are created in
+    // root_path/gen-N, after max_dirs directories or max_age_s seconds the process moves on to
+    // gen-N+1, so the root and the current generation never accumulate the large directory
+    // index left behind by millions of deleted entries. A generation created by the process is
+    // retired then and removed in the background once it is empty, generations created by
+    // other processes are left alone. Ignored in session mode and for open_or_create.
+    Config& set_generation_rotation(std::size_t max_dirs, std::uint64_t max_age_s = 0)
+    {
+        this->generation_max_dirs = max_dirs;
+        this->generation_max_age_s = max_age_s;
+        return *this;
+    }
+
+    // Bounds the synchronous part of cleanup to the given number of microseconds and/or removed
+    // entries (0 = unbounded). Small temporary directories are still gone when cleanup returns,
+    // whatever remains of large ones is renamed to <name>.removing and removed by a background
+    // thread, which is joined at process exit.
+    Config& set_cleanup_budget(std::uint64_t budget_us, std::size_t max_entries = 0)
+    {
+        this->cleanup_budget_us = budget_us;
+        this->cleanup_budget_entries = max_entries;
+        return *this;
+    }
+
+    // Sets how temporary directories are removed. CleanupStrategy::adaptive estimates the size
+    // of the tree by sampling random paths and picks the cheapest strategy from a cost model of
+    // the filesystem. The model is calibrated by a short probe once per device and cached for
+    // the process. Synchronous removal predicted to exceed the cleanup budget (or 20ms without
+    // budget) is deferred to the background.
+    Config& set_cleanup_strategy(CleanupStrategy cleanup_strategy)
+    {
+        this->cleanup_strategy = cleanup_strategy;
+        return *this;
+    }
+
+    // Avoids creating temporary directories on an overlayfs or aufs root (e.g. /tmp inside a
+    // container), where metadata operations are slower and writes fill the container layer.
+    // If the root path is on such a filesystem, the first writable volume root that is not, or
+    // else /dev/shm if it is a tmpfs, is used instead. See TempDir::inspect_root.
+    Config& set_avoid_container_layer(bool avoid, std::vector<fs::path> volume_roots = {})
+    {
+        this->avoid_container_layer = avoid;
+        this->volume_roots = std::move(volume_roots);
+        return *this;
+    }
+
+    // Makes the TempDir migratable to the given disk root (see TempDir::migrate), e.g. to free
+    // a tmpfs root under memory pressure. The contents are stored in <name>.d next to the
+    // path of the TempDir, which is a symlink that is atomically swapped on migration.
+    // Cleanup of a migratable TempDir always removes its contents serially, the cleanup
+    // strategy and budget do not apply.
+    Config& set_migration_root(const fs::path& migration_root)
+    {
+        this->migration_root = migration_root;
+        return *this;
+    }
+
+    // Records the operations of the TempDir into the given trace, the recorder has to outlive
+    // the TempDir. Without recorder only a null check is done per operation.
+    Config& set_trace_recorder(TraceRecorder* trace_recorder)
+    {
+        this->trace_recorder = trace_recorder;
+        return *this;
+    }
+
     Config& enable_logging()
     {
         this->log_impl = bw::tempdir::log;
@@ -83,142 +333,4021 @@ struct Config
     }
 };
 
-// TempDir manages temporary directories with automatic cleanup based on user-defined policies.
-//
-// The TempDir class is designed to simplify the creation and management of temporary directories.
-// It supports automatic cleanup based on configurable policies (e.g., always cleanup, cleanup only
-// on successful execution, or never cleanup). The class ensures proper handling of errors during
-// directory creation and cleanup, and on demand logs relevant messages for each operation.
-//
-// The directory is created in a user-specified or default root path and given a unique name
-// generated based on a timestamp and a random number. Errors related to directory operations
-// are wrapped in TempDirException.
+// enum of directory entry types reported by TempDir::list
+enum class EntryType : std::uint8_t
+{
+    unknown,
+    file,
+    directory,
+    symlink,
+    other
+};
+
+// struct holding options for TempDir::list
+// With recursive enabled all subdirectories are listed as well, one directory level at a time
+// with the directories of a level being read in parallel.
+struct ListOptions
+{
+    bool recursive = false;
+    std::size_t threads = 0; // 0 = one thread per hardware thread
+
+    ListOptions& set_recursive(bool recursive)
+    {
+        this->recursive = recursive;
+        return *this;
+    }
+
+    ListOptions& set_threads(std::size_t threads)
+    {
+        this->threads = threads;
+        return *this;
+    }
+};
+
+// Listing holds the entries of a directory sorted by name.
 //
-// Cleanup will be automatically handled based on the configured policy when the TempDir object goes
-// out of scope or when cleanup method is called explicitly
-class TempDir
+// Entries are stored as struct-of-arrays: all names live in one contiguous arena and are
+// accessed by index as string_view, types and inode numbers are kept in parallel arrays.
+// Names are relative to the listed directory and use '/' as separator for nested entries.
+// Inode numbers are only available on POSIX systems and are 0 elsewhere.
+class Listing
 {
   public:
-    // Constructs a TempDir with a specified root path
-    // where the temporary directory will be created.
-    explicit TempDir(fs::path root_path) : TempDir(Config().set_root_path(root_path)) {}
+    explicit Listing(std::pmr::memory_resource* memory_resource = std::pmr::get_default_resource())
+        : _names(memory_resource), _offsets(1, 0, memory_resource), _types(memory_resource),
+          _inodes(memory_resource)
+    {
+    }
 
-    //  Constructs a TempDir with a specified root path and cleanup policy.
-    //  root_path: The root path where the temporary directory will be created.
-    //  cleanup: The cleanup policy to apply when the object is destroyed.
-    explicit TempDir(fs::path root_path, Cleanup cleanup)
-        : TempDir(Config().set_root_path(root_path).set_cleanup(cleanup))
+    std::size_t size() const { return _types.size(); }
+    bool empty() const { return _types.empty(); }
+
+    std::string_view name(std::size_t index) const
     {
+        return std::string_view(_names).substr(_offsets[index],
+                                               _offsets[index + 1] - _offsets[index]);
     }
 
-    // Constructs a TempDir with a specified cleanup policy
-    // which will be applied when the object is destroyed.
-    explicit TempDir(Cleanup cleanup) : TempDir(Config().set_cleanup(cleanup)) {}
+    EntryType type(std::size_t index) const { return _types[index]; }
+    std::uint64_t inode(std::size_t index) const { return _inodes[index]; }
 
-    // Constructs a TempDir with a fully specified configuration for the TempDir,
-    // including path, prefix, cleanup policy, and logging.
-    // If an error occurs during construction, a TempDirException is thrown.
-    explicit TempDir(Config config = {}) : _config(config)
+    const std::pmr::vector<EntryType>& types() const { return _types; }
+    const std::pmr::vector<std::uint64_t>& inodes() const { return _inodes; }
+
+    std::pmr::memory_resource* memory_resource() const { return _names.get_allocator().resource(); }
+
+    // Returns all names in sorted order.
+    std::vector<std::string_view> names() const
     {
-        try
-        {
-            _temp_dir = config.root_path / generate_dir_name();
-            fs::create_directories(_temp_dir);
-            log("TempDir create '" + _temp_dir.string() + "'");
-        }
-        catch (const std::exception& ex)
-        {
-            log("TempDir creation of '" + _temp_dir.string() + "' failed. Error: " + ex.what());
-            throw TempDirException(ex);
-        }
+        std::vector<std::string_view> result;
+        result.reserve(size());
+        for (std::size_t i = 0; i < size(); ++i)
+            result.push_back(name(i));
+        return result;
     }
 
-    // Destructor that handles automatic cleanup based on the configured policy.
-    //
-    // Attempts to clean up the temporary directory if the cleanup policy allows it.
-    // Errors during cleanup are logged but not rethrown
-    ~TempDir()
+    // Appends an entry, the listing has to be sorted afterwards.
+    void append(std::string_view prefix, std::string_view name, EntryType type,
+                std::uint64_t inode)
     {
-        try
-        {
-            cleanup();
-        }
-        catch (const std::exception& e)
-        {
-            // do nothing as rethrowing is not allowed in destructor
-            // error was already logged in cleanup method
-        }
+        _names.append(prefix);
+        _names.append(name);
+        _offsets.push_back(_names.size());
+        _types.push_back(type);
+        _inodes.push_back(inode);
     }
 
-    // Copying TempDir is disabled
-    TempDir(const TempDir&) = delete;
-    TempDir& operator=(const TempDir&) = delete;
+    // Appends all entries of another listing.
+    void append(const Listing& other)
+    {
+        for (std::size_t i = 0; i < other.size(); ++i)
+            append({}, other.name(i), other.type(i), other.inode(i));
+    }
 
-    // Moving TempDir is enabeld
-    TempDir(TempDir&&) = default;
-    TempDir& operator=(TempDir&&) = default;
+    // Sorts the entries by name and compacts them into a fresh arena in sorted order.
+    void sort();
 
-    // Returns the path of the managed temporary directory.
-    const std::filesystem::path& path() const { return _temp_dir; }
+  private:
+    std::pmr::string _names;
+    std::pmr::vector<std::size_t> _offsets;
+    std::pmr::vector<EntryType> _types;
+    std::pmr::vector<std::uint64_t> _inodes;
+};
 
-    // Manually triggers cleanup of the temporary directory.
-    // Attempts to delete the directory and its contents based on the configured
-    // cleanup policy. If an error occurs during cleanup, a TempDirException is thrown.
-    void cleanup()
+// struct holding options for TempDir::prefetch
+// It allows to block until the prefetched files are read into the page cache
+// and to limit the number of threads used to issue the read-ahead requests.
+struct PrefetchOptions
+{
+    bool wait = false;
+    std::size_t threads = 0; // 0 = one thread per hardware thread
+
+    PrefetchOptions& set_wait(bool wait)
     {
-        if (!fs::exists(_temp_dir))
-            return;
+        this->wait = wait;
+        return *this;
+    }
 
-        bool always_cleanup = _config.cleanup == Cleanup::always;
-        bool on_sucess_cleanup_no_exception =
-            _config.cleanup == Cleanup::on_success && std::uncaught_exceptions() <= 0;
+    PrefetchOptions& set_threads(std::size_t threads)
+    {
+        this->threads = threads;
+        return *this;
+    }
+};
 
-        if (!always_cleanup && !on_sucess_cleanup_no_exception)
-        {
-            log("TempDir keep '" + _temp_dir.string() + "'");
-            return;
-        }
+// struct holding the outcome of TempDir::prefetch
+// Resident byte counts are only available on platforms supporting mincore and stay 0 elsewhere.
+// resident_bytes_after is only determined when PrefetchOptions::wait is enabled.
+struct PrefetchResult
+{
+    std::size_t files = 0;
+    std::uintmax_t total_bytes = 0;
+    std::uintmax_t resident_bytes_before = 0;
+    std::uintmax_t resident_bytes_after = 0;
+};
 
-        try
-        {
-            fs::remove_all(_temp_dir);
-            log("TempDir remove '" + _temp_dir.string() + "'");
-        }
-        catch (const std::exception& ex)
-        {
-            log("TempDir removal of '" + _temp_dir.string() + "' failed. Error: " + ex.what());
-            throw TempDirException(ex);
-        }
+// struct holding options for TempDir::cache_footprint
+// For huge trees the footprint can be estimated from a sample of files: if the tree contains
+// more than max_files regular files, only an evenly spaced subset of max_files is inspected
+// and the result is extrapolated.
+struct FootprintOptions
+{
+    std::size_t threads = 0; // 0 = one thread per hardware thread
+    std::size_t max_files = 0; // 0 = inspect all files
+
+    FootprintOptions& set_threads(std::size_t threads)
+    {
+        this->threads = threads;
+        return *this;
+    }
+
+    FootprintOptions& set_max_files(std::size_t max_files)
+    {
+        this->max_files = max_files;
+        return *this;
+    }
+};
+
+// struct holding the page cache footprint of a temporary directory in bytes
+// Dirty and writeback bytes are only available where the cachestat syscall is supported
+// and stay 0 elsewhere. If the result was extrapolated from a sample, estimated is set.
+struct CacheFootprint
+{
+    std::size_t files = 0;
+    std::size_t inspected_files = 0;
+    std::uintmax_t total_bytes = 0;
+    std::uintmax_t resident_bytes = 0;
+    std::uintmax_t dirty_bytes = 0;
+    std::uintmax_t writeback_bytes = 0;
+    bool estimated = false;
+};
+
+// struct describing a file to be written by TempDir::write_files
+// The path is relative to the temporary directory, content has to stay valid during the call.
+struct FileSpec
+{
+    fs::path path;
+    std::string_view content;
+};
+
+// struct holding options for TempDir::write_files
+struct WriteOptions
+{
+    std::size_t threads = 0; // 0 = one thread per hardware thread
+
+    WriteOptions& set_threads(std::size_t threads)
+    {
+        this->threads = threads;
+        return *this;
+    }
+};
+
+// struct describing a single entry of a Fixture
+// FixtureEntry is a literal type, so fixture layouts can be declared constexpr:
+//
+//   constexpr FixtureEntry layout[] = {
+//       FixtureEntry::dir("logs"),
+//       FixtureEntry::file("config/app.json", R"({"debug": true})"),
+//   };
+struct FixtureEntry
+{
+    std::string_view path;
+    std::string_view content;
+    bool is_directory = false;
+
+    static constexpr FixtureEntry dir(std::string_view path) { return {path, {}, true}; }
+
+    static constexpr FixtureEntry file(std::string_view path, std::string_view content)
+    {
+        return {path, content, false};
+    }
+};
+
+// Fixture describes a directory tree, that can be materialized into a TempDir
+// and used to verify a directory against the expected layout afterwards.
+//
+// A Fixture consists of directories and files with inline content or content produced by
+// a generator callback. Nested fixtures can be added below a directory. The same description
+// drives TempDir::materialize and TempDir::verify, so setup and verification share one layout.
+class Fixture
+{
+  public:
+    using Generator = std::function<std::string()>;
+
+    struct Node
+    {
+        fs::path path;
+        bool is_directory = false;
+        std::string content;
+        Generator generator;
+
+        // Returns the file content, calling the generator if present.
+        std::string resolve_content() const { return generator ? generator() : content; }
+    };
+
+    Fixture() = default;
+
+    // Constructs a Fixture from a list of (possibly constexpr) entries.
+    Fixture(std::initializer_list<FixtureEntry> entries) { add(entries.begin(), entries.end()); }
+
+    // Constructs a Fixture from a (possibly constexpr) array of entries.
+    template <std::size_t N> explicit Fixture(const FixtureEntry (&entries)[N])
+    {
+        add(entries, entries + N);
+    }
+
+    // Adds an empty directory.
+    Fixture& dir(const fs::path& path)
+    {
+        _nodes.push_back({path, true, {}, {}});
+        return *this;
+    }
+
+    // Adds all entries of a nested fixture below the given directory.
+    Fixture& dir(const fs::path& path, const Fixture& nested)
+    {
+        dir(path);
+        for (const auto& node : nested._nodes)
+            _nodes.push_back({path / node.path, node.is_directory, node.content, node.generator});
+        return *this;
+    }
+
+    // Adds a file with inline content.
+    Fixture& file(const fs::path& path, std::string_view content)
+    {
+        _nodes.push_back({path, false, std::string(content), {}});
+        return *this;
+    }
+
+    // Adds a file whose content is produced by a generator. Generators are called concurrently
+    // by materialize and verify, and once by each of them, so they must be thread-safe and
+    // return the same content on every call.
+    Fixture& file(const fs::path& path, Generator generator)
+    {
+        _nodes.push_back({path, false, {}, std::move(generator)});
+        return *this;
     }
 
+    const std::vector<Node>& nodes() const { return _nodes; }
+
   private:
-    // Generates a unique name for the temporary directory.
-    std::string generate_dir_name()
+    void add(const FixtureEntry* begin, const FixtureEntry* end)
     {
-        using namespace std::chrono;
+        for (auto it = begin; it != end; ++it)
+        {
+            if (it->is_directory)
+                dir(fs::path(it->path));
+            else
+                file(fs::path(it->path), it->content);
+        }
+    }
 
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dist(10000, 99999);
-        int random_number = dist(gen);
+    std::vector<Node> _nodes;
+};
 
-        auto now = system_clock::now();
-        auto timestamp = duration_cast<milliseconds>(now.time_since_epoch()).count();
+// struct holding options for TempDir::materialize
+// With deduplicate enabled files with identical content are created as hardlinks of one
+// another. This saves writes for large fixtures, but modifying such a file in place modifies
+// all of its duplicates, therefore it is disabled by default.
+struct MaterializeOptions
+{
+    std::size_t threads = 0; // 0 = one thread per hardware thread
+    bool deduplicate = false;
 
-        std::string ts = std::to_string(timestamp);
-        std::string rn = std::to_string(random_number);
-        return _config.temp_dir_prefix + "_" + ts + "_" + rn;
+    MaterializeOptions& set_threads(std::size_t threads)
+    {
+        this->threads = threads;
+        return *this;
     }
 
-    // Logs a message using the configured logging implementation.
-    void log(const std::string& message)
+    MaterializeOptions& set_deduplicate(bool deduplicate)
     {
-        if (_config.log_impl)
-            _config.log_impl(message);
+        this->deduplicate = deduplicate;
+        return *this;
     }
+};
 
-    std::filesystem::path _temp_dir;
-    Config _config;
+// struct holding options for TempDir::verify
+// With exact enabled entries not described by the fixture are reported as well.
+struct VerifyOptions
+{
+    std::size_t threads = 0; // 0 = one thread per hardware thread
+    bool exact = false;
+
+    VerifyOptions& set_threads(std::size_t threads)
+    {
+        this->threads = threads;
+        return *this;
+    }
+
+    VerifyOptions& set_exact(bool exact)
+    {
+        this->exact = exact;
+        return *this;
+    }
 };
 
-} // namespace bw::tempdir
+// PathBuilder builds paths of entries below a base directory in one reused buffer.
+//
+// Joining paths with fs::path::operator/ allocates a new path and copies the full prefix on
+// every call. PathBuilder keeps the base directory and a separator in its buffer and only
+// replaces the trailing relative part, so building paths in hot loops does not allocate once
+// the buffer has grown to the longest path. Returned references stay valid until the next call.
+class PathBuilder
+{
+  public:
+    using value_type = fs::path::value_type;
+    using string_type = fs::path::string_type;
+    using string_view_type = std::basic_string_view<value_type>;
+
+    explicit PathBuilder(const fs::path& base, std::size_t reserve = 256)
+        : _buffer(base.native())
+    {
+        if (!_buffer.empty() && _buffer.back() != fs::path::preferred_separator)
+            _buffer.push_back(fs::path::preferred_separator);
+        _base_length = _buffer.size();
+        _buffer.reserve(_base_length + reserve);
+    }
+
+    // Returns the native path string of base / relative.
+    const string_type& native(string_view_type relative)
+    {
+        _buffer.resize(_base_length);
+        _buffer.append(relative);
+        return _buffer;
+    }
+
+    // Returns the null-terminated native path of base / relative.
+    const value_type* c_str(string_view_type relative) { return native(relative).c_str(); }
+
+    // Returns base / relative as fs::path, which allocates like regular path joining.
+    fs::path path(string_view_type relative) const
+    {
+        return fs::path(string_type(_buffer, 0, _base_length)).append(relative);
+    }
+
+  private:
+    string_type _buffer;
+    std::size_t _base_length;
+};
+
+namespace detail
+{
+// Appends message parts of various types to a log message.
+inline void append_part(std::string& message, const char* part) { message.append(part); }
+inline void append_part(std::string& message, const std::string& part) { message.append(part); }
+inline void append_part(std::string& message, std::string_view part) { message.append(part); }
+inline void append_part(std::string& message, const fs::path& part)
+{
+    message.append(part.string());
+}
+
+struct RemovalBudget;
+
+// Owning pointer to an object created on first use. Concurrent first uses race on a
+// compare-exchange of this instance instead of taking a lock, the losers discard their object.
+template <typename T> class LazyPtr
+{
+  public:
+    LazyPtr() = default;
+    LazyPtr(LazyPtr&& other) noexcept : _ptr(other._ptr.exchange(nullptr)) {}
+    LazyPtr& operator=(LazyPtr&& other) noexcept
+    {
+        delete _ptr.exchange(other._ptr.exchange(nullptr));
+        return *this;
+    }
+    ~LazyPtr() { delete _ptr.load(); }
+
+    // Returns the object, constructing it from the arguments if it does not exist yet.
+    template <typename... Args> T& get_or_create(Args&&... args) const
+    {
+        T* current = _ptr.load(std::memory_order_acquire);
+        if (current)
+            return *current;
+        auto created = std::make_unique<T>(std::forward<Args>(args)...);
+        if (_ptr.compare_exchange_strong(current, created.get(), std::memory_order_acq_rel))
+            return *created.release();
+        return *current;
+    }
+
+    T* operator->() const { return _ptr.load(std::memory_order_acquire); }
+    explicit operator bool() const { return _ptr.load(std::memory_order_acquire) != nullptr; }
+
+  private:
+    mutable std::atomic<T*> _ptr{nullptr};
+};
+} // namespace detail
+
+// TempDir manages temporary directories with automatic cleanup based on user-defined policies.
+//
+// The TempDir class is designed to simplify the creation and management of temporary directories.
+// It supports automatic cleanup based on configurable policies (e.g., always cleanup, cleanup only
+// on successful execution, or never cleanup). The class ensures proper handling of errors during
+// directory creation and cleanup, and on demand logs relevant messages for each operation.
+//
+// The directory is created in a user-specified or default root path and given a unique name
+// generated based on a timestamp and a random number. Errors related to directory operations
+// are wrapped in TempDirException.
+//
+// Cleanup will be automatically handled based on the configured policy when the TempDir object goes
+// out of scope or when cleanup method is called explicitly
+class TempDir
+{
+  public:
+    // Constructs a TempDir with a specified root path
+    // where the temporary directory will be created.
+    explicit TempDir(fs::path root_path) : TempDir(Config().set_root_path(root_path)) {}
+
+    //  Constructs a TempDir with a specified root path and cleanup policy.
+    //  root_path: The root path where the temporary directory will be created.
+    //  cleanup: The cleanup policy to apply when the object is destroyed.
+    explicit TempDir(fs::path root_path, Cleanup cleanup)
+        : TempDir(Config().set_root_path(root_path).set_cleanup(cleanup))
+    {
+    }
+
+    // Constructs a TempDir with a specified cleanup policy
+    // which will be applied when the object is destroyed.
+    explicit TempDir(Cleanup cleanup) : TempDir(Config().set_cleanup(cleanup)) {}
+
+    // Constructs a TempDir with a fully specified configuration for the TempDir,
+    // including path, prefix, cleanup policy, and logging.
+    // If an error occurs during construction, a TempDirException is thrown.
+    explicit TempDir(Config config = {});
+
+    // Constructs a TempDir like TempDir(config) and captures the caller as call site, which
+    // is reported along with slow operations. TempDirs constructed directly have no call site.
+    static TempDir create(Config config = {}, CallSite call_site = CallSite::current());
+
+    // Destructor that handles automatic cleanup based on the configured policy.
+    //
+    // Attempts to clean up the temporary directory if the cleanup policy allows it.
+    // Errors during cleanup are logged but not rethrown
+    ~TempDir();
+
+    // Copying TempDir is disabled
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    // Opens the persistent temporary directory root_path/<prefix>_<key>, it is created if it
+    // does not exist yet. The same key always maps to the same directory, so a restarted job
+    // can resume from the artifacts recorded as completed (see mark_completed). An exclusive
+    // lock guarantees a single owner, if the directory is owned by another TempDir or process,
+    // a TempDirException is thrown. The manifest of completed artifacts is stored next to the
+    // directory and removed along with it. Use Cleanup::on_success or Cleanup::never to keep
+    // the directory when a job fails. Locking is only supported on POSIX systems.
+    static TempDir open_or_create(std::string_view key, Config config = {},
+                                  CallSite call_site = CallSite::current());
+
+    // Moving TempDir is enabeld
+    TempDir(TempDir&&) noexcept;
+    TempDir& operator=(TempDir&&) noexcept;
+
+    // Returns the path of the managed temporary directory.
+    const std::filesystem::path& path() const { return _temp_dir; }
+
+    // Returns the configuration of the TempDir.
+    const Config& config() const { return _config; }
+
+    // Moves the contents to Config::migration_root while path() stays valid: the contents are
+    // copied, the symlink at path() is swapped atomically and the old contents are removed.
+    // Returns false without changes if the TempDir is not migratable, not declared quiescent
+    // (see set_quiescent), already migrated or written by write_files or materialize before
+    // the swap. If the old contents changed during the copy anyway, the swap is reverted and
+    // false is returned. If an error occurs, the copy is discarded and false is returned.
+    bool migrate();
+
+    // Declares whether the TempDir is quiescent: no files in it are open and it is written
+    // only through write_files and materialize. Only quiescent TempDirs are migrated, as
+    // files opened before a migration would keep referring to the removed old contents.
+    // TempDirs are not quiescent after creation.
+    void set_quiescent(bool quiescent);
+
+    // Returns true if the contents were moved to Config::migration_root.
+    bool migrated() const;
+
+    // Returns the call site the TempDir was created from.
+    const CallSite& call_site() const { return _call_site; }
+
+    // Returns a PathBuilder for building paths of entries in the temporary directory
+    // without allocating per path.
+    PathBuilder path_builder() const { return PathBuilder(_temp_dir); }
+
+    // Warms the page cache for the given files, directories are prefetched recursively.
+    // Relative paths are resolved against the temporary directory, an empty list of paths
+    // prefetches the whole temporary directory. Read-ahead requests are issued in parallel
+    // (posix_fadvise WILLNEED). With PrefetchOptions::wait the files are read through, so that
+    // they are resident when the call returns. The result reports how many bytes were already
+    // resident before prefetching. If a path can not be accessed, a TempDirException is thrown.
+    PrefetchResult prefetch(const std::vector<fs::path>& paths = {},
+                            PrefetchOptions options = {}) const;
+
+    // Manually triggers cleanup of the temporary directory.
+    // Attempts to delete the directory and its contents based on the configured
+    // cleanup policy. Entries created by write_files and materialize are unlinked in reverse
+    // creation order without scanning directories, only entries created otherwise are found
+    // by a directory scan. Read-only subdirectories are made writable during the same scan,
+    // the parent of the temporary directory is never modified.
+    // If an error occurs during cleanup, a TempDirException is thrown.
+    void cleanup();
+
+    // Reports how much of the temporary directory is held in the page cache.
+    // Allows to attribute page cache pressure to the job owning the temporary directory.
+    // Files are inspected in parallel, for huge trees the footprint can be estimated from a
+    // sample (see FootprintOptions). If the directory can not be traversed,
+    // a TempDirException is thrown.
+    CacheFootprint cache_footprint(FootprintOptions options = {}) const;
+
+    // Writes a batch of files into the temporary directory.
+    // All required parent directories are created once up front, afterwards the files are
+    // written in parallel. On POSIX systems files are created relative to a descriptor of the
+    // temporary directory, so no absolute path has to be resolved per file. Paths have to be
+    // relative and must not escape the temporary directory. If a file can not be written,
+    // a TempDirException is thrown.
+    void write_files(const std::vector<FileSpec>& files, WriteOptions options = {}) const;
+
+    // Creates the directory tree described by the fixture inside the temporary directory.
+    // Directories are created parents first, file contents are generated and written in
+    // parallel. Optionally files with identical content are deduplicated using hardlinks
+    // (see MaterializeOptions). If the fixture can not be materialized,
+    // a TempDirException is thrown.
+    void materialize(const Fixture& fixture, MaterializeOptions options = {}) const;
+
+    // Compares the temporary directory against the layout described by the fixture.
+    // Returns a description of each difference found, an empty result means the directory
+    // matches the fixture. File contents are compared in parallel.
+    std::vector<std::string> verify(const Fixture& fixture, VerifyOptions options = {}) const;
+
+    // Lists the entries of the temporary directory sorted by name.
+    // Entries are read with large directory buffers and stored in a single name arena
+    // (see Listing). With ListOptions::recursive all subdirectories are listed as well,
+    // the directories of each level are read in parallel. If the directory can not be read,
+    // a TempDirException is thrown.
+    Listing list(ListOptions options = {}) const;
+
+    // Returns true if the temporary directory was opened by open_or_create and existed before.
+    bool resumed() const;
+
+    // Records an artifact of a directory opened by open_or_create as completed. The manifest is
+    // synced to disk before returning, artifact names must not contain line breaks.
+    // If the artifact can not be recorded, a TempDirException is thrown.
+    void mark_completed(std::string_view artifact);
+
+    // Returns true if the artifact was recorded as completed, also by a previous process.
+    bool completed(std::string_view artifact) const;
+
+    // Returns all artifacts recorded as completed in the order they were recorded.
+    std::vector<std::string> completed_artifacts() const;
+
+    // Removes the session directories (see Config::set_session) of processes that are no longer
+    // running from config.root_path, unless a session contains kept temporary directories.
+    // A process counts as exited only if /proc shows no process with its pid and start time in
+    // the same pid namespace, so sessions are never reaped on platforms without /proc.
+    // Returns the number of removed sessions. If the root path can not be read,
+    // a TempDirException is thrown.
+    static std::size_t reap_sessions(const Config& config = {});
+
+    // Returns the filesystem type and mount point of the given root path, detected via
+    // statfs and the given mountinfo table (Linux). Results are cached per path and mountinfo.
+    static RootInfo inspect_root(const fs::path& path,
+                                 const fs::path& mountinfo = "/proc/self/mountinfo");
+
+    // Returns the root path temporary directories of the configuration are created in,
+    // which differs from config.root_path if the container layer is avoided.
+    static fs::path select_root(const Config& config);
+
+  private:
+    friend class SharedTempDir;
+    friend class MemoryPressureWatcher;
+    struct Journal;
+    struct Persistence;
+    struct Migration;
+
+    // Creates a temporary directory, see TempDir(Config).
+    TempDir(Config config, CallSite call_site);
+
+    // Takes ownership of an existing persistent temporary directory.
+    TempDir(Config config, fs::path path, std::unique_ptr<Persistence> persistence,
+            CallSite call_site);
+
+    // Generates a unique name for the temporary directory.
+    std::pmr::string generate_dir_name() const;
+
+    // Returns the journal of the entries created by the library, creating it on first use.
+    Journal& journal() const;
+
+    // Removes the journaled entries and the temporary directory, falls back to a directory
+    // scan for entries not covered by the journal. Removal stops early once the budget is
+    // exhausted. With more than one thread (0 = hardware concurrency), journaled files and the
+    // scanned subtrees are removed in parallel. Returns the number of removed entries.
+    std::uintmax_t remove_journaled(detail::RemovalBudget* budget = nullptr,
+                                    std::size_t threads = 1);
+
+    // Chooses the strategy of CleanupStrategy::adaptive for the current contents.
+    CleanupStrategy choose_cleanup_strategy() const;
+
+    // Renames the remains of the temporary directory aside and removes them in the background.
+    // Falls back to synchronous removal if renaming fails, returns the entries removed by it.
+    std::uintmax_t remove_in_background();
+
+    // Reports the operation if it exceeded the configured threshold.
+    void report_if_slow(SlowOperation& operation) const;
+
+    // Writes the files without recording a trace event, see write_files.
+    void write_files_impl(const std::vector<FileSpec>& files, WriteOptions options) const;
+
+    // Logs a message using the configured logging implementation.
+    // The message is only assembled from its parts if logging is enabled.
+    template <typename... Parts> void log(const Parts&... parts) const
+    {
+        if (!_config.log_impl)
+            return;
+
+        std::string message;
+        (detail::append_part(message, parts), ...);
+        _config.log_impl(message);
+    }
+
+    std::filesystem::path _temp_dir;
+    Config _config;
+    detail::LazyPtr<Journal> _journal;
+    std::unique_ptr<Persistence> _persistence;
+    CallSite _call_site;
+    std::uint32_t _trace_id = 0;
+    std::shared_ptr<Migration> _migration;
+};
+
+// SharedTempDir is a copyable handle to a temporary directory shared by several owners,
+// e.g. the stages of a pipeline running on different threads.
+//
+// Copies refer to the same directory, it is cleaned up according to the configured policy
+// when the last owner is gone. With create_cross_process() and attach() the directory is
+// shared between processes as well: owners are counted in the file <directory>.refs under an
+// exclusive flock and the last owner of the last process cleans up. A process crashing while
+// attached leaves its reference behind, so the directory is kept. Sharing between processes
+// is only supported on POSIX systems.
+class SharedTempDir
+{
+  public:
+    // Constructs a temporary directory shared by the copies of this handle within the process.
+    // If an error occurs during construction, a TempDirException is thrown.
+    explicit SharedTempDir(Config config = {});
+
+    // Constructs a temporary directory that can be attached to by other processes.
+    // If an error occurs, a TempDirException is thrown.
+    static SharedTempDir create_cross_process(Config config = {},
+                                              CallSite call_site = CallSite::current());
+
+    // Attaches to a temporary directory created by create_cross_process() in another process.
+    // The cleanup policy of config applies if this process is the last owner. If the directory
+    // does not exist or is being removed, a TempDirException is thrown.
+    static SharedTempDir attach(const fs::path& path, Config config = {},
+                                CallSite call_site = CallSite::current());
+
+    // Returns the path of the shared temporary directory.
+    const fs::path& path() const { return _temp_dir->path(); }
+
+    // Returns the shared temporary directory.
+    TempDir& temp_dir() const { return *_temp_dir; }
+    TempDir* operator->() const { return _temp_dir.get(); }
+
+    // Returns the number of owners within this process.
+    long use_count() const { return _temp_dir.use_count(); }
+
+  private:
+    explicit SharedTempDir(std::shared_ptr<TempDir> temp_dir) : _temp_dir(std::move(temp_dir)) {}
+
+    // Shares the temporary directory with a deleter releasing the reference of this process.
+    static std::shared_ptr<TempDir> share_cross_process(std::unique_ptr<TempDir> temp_dir);
+
+    std::shared_ptr<TempDir> _temp_dir;
+};
+
+// TempDirPool provides pre-created temporary directories that are leased and recycled.
+//
+// Creating and removing a temporary directory per test is comparably expensive. A pool keeps a
+// number of empty directories below a root TempDir, leasing one renames it after the given name
+// (e.g. the test name) for debuggability. Returning a lease empties the directory and hands it
+// back to the pool instead of deleting it. When the pool is destroyed, all remaining
+// directories are removed in one parallel pass according to the configured cleanup policy.
+// The pool is thread-safe and has to outlive its leases.
+class TempDirPool
+{
+  public:
+    // Lease of a pooled directory, the directory is returned to the pool on destruction.
+    class Lease
+    {
+      public:
+        Lease() = default;
+        ~Lease();
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+
+        // Returns the path of the leased directory.
+        const fs::path& path() const { return _path; }
+
+        // Returns true if the lease holds a directory.
+        explicit operator bool() const { return _pool != nullptr; }
+
+        // Removes all contents of the leased directory, the directory itself is kept.
+        // If an error occurs, a TempDirException is thrown.
+        void reset();
+
+        // Returns the directory to the pool, afterwards the lease is empty.
+        void release();
+
+      private:
+        friend class TempDirPool;
+        Lease(TempDirPool* pool, fs::path path) : _pool(pool), _path(std::move(path)) {}
+
+        TempDirPool* _pool = nullptr;
+        fs::path _path;
+    };
+
+    // Constructs a pool with the given number of pre-created directories below a root TempDir
+    // created according to config. If an error occurs, a TempDirException is thrown.
+    explicit TempDirPool(Config config = {}, std::size_t size = 4);
+
+    // Removes all pooled and leftover directories in one parallel pass,
+    // according to the configured cleanup policy.
+    ~TempDirPool();
+
+    TempDirPool(const TempDirPool&) = delete;
+    TempDirPool& operator=(const TempDirPool&) = delete;
+
+    // Returns the root directory containing all pooled directories.
+    const fs::path& root() const { return _root.path(); }
+
+    // Leases a directory named after the given name. A new directory is created
+    // if no pre-created one is available. If an error occurs, a TempDirException is thrown.
+    Lease acquire(std::string_view name = {});
+
+    // Returns the number of directories available for leasing without creating new ones.
+    std::size_t available() const;
+
+  private:
+    struct State;
+
+    void give_back(const fs::path& path);
+
+    TempDir _root;
+    std::unique_ptr<State> _state;
+};
+
+// struct holding a sample of the memory pressure of the system
+struct MemoryPressure
+{
+    double some_avg10 = 0;           // share of time (%) tasks stalled on memory, last 10s
+    std::uint64_t mem_available = 0; // bytes, 0 if unknown
+};
+
+// struct holding the thresholds of MemoryPressureWatcher
+struct MemoryPressureOptions
+{
+    double some_avg10 = 10.0;            // PSI threshold in percent, 0 = ignored
+    std::uint64_t min_mem_available = 0; // bytes, 0 = ignored
+    std::uint64_t poll_interval_ms = 1000;
+
+    MemoryPressureOptions& set_some_avg10(double some_avg10)
+    {
+        this->some_avg10 = some_avg10;
+        return *this;
+    }
+
+    MemoryPressureOptions& set_min_mem_available(std::uint64_t min_mem_available)
+    {
+        this->min_mem_available = min_mem_available;
+        return *this;
+    }
+
+    MemoryPressureOptions& set_poll_interval_ms(std::uint64_t poll_interval_ms)
+    {
+        this->poll_interval_ms = poll_interval_ms;
+        return *this;
+    }
+};
+
+// MemoryPressureWatcher migrates temporary directories off RAM roots under memory pressure.
+//
+// A background thread samples the memory PSI (/proc/pressure/memory) and MemAvailable
+// (/proc/meminfo). While a threshold is crossed, all migratable TempDirs of the process
+// (see Config::set_migration_root) that are declared quiescent (see TempDir::set_quiescent)
+// and not being written are migrated.
+class MemoryPressureWatcher
+{
+  public:
+    explicit MemoryPressureWatcher(MemoryPressureOptions options = {});
+    ~MemoryPressureWatcher();
+
+    MemoryPressureWatcher(const MemoryPressureWatcher&) = delete;
+    MemoryPressureWatcher& operator=(const MemoryPressureWatcher&) = delete;
+
+    // Returns the number of TempDirs migrated by this watcher.
+    std::size_t migrated() const;
+
+    // Samples the current memory pressure, values that can not be read are 0.
+    static MemoryPressure sample();
+
+  private:
+    struct State;
+    std::unique_ptr<State> _state;
+};
+
+} // namespace bw::tempdir
+
+#if !defined(TD_COMPILED_LIBRARY) || defined(TD_IMPLEMENTATION)
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TD_POSIX 1
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#include <process.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#endif
+
+#ifdef __APPLE__
+#include <sys/mount.h>
+#include <sys/param.h>
+#endif
+
+#include <bw/tempdir/tempdir_parallel.hpp>
+
+namespace bw::tempdir
+{
+
+TD_INLINE void log(const std::string& message) { std::cout << message << std::endl; }
+
+namespace detail
+{
+// Memory resource adaptor serializing all allocations to an upstream resource with a mutex.
+// Used to share a not thread-safe resource (e.g. monotonic_buffer_resource) between workers.
+class SynchronizedResource : public std::pmr::memory_resource
+{
+  public:
+    explicit SynchronizedResource(std::pmr::memory_resource* upstream) : _upstream(upstream) {}
+
+  private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _upstream->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _upstream->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource* _upstream;
+    std::mutex _mutex;
+};
+
+// Returns a per-thread I/O buffer of at least the given size. Buffers are reused across calls,
+// so transient I/O does not allocate per file or directory.
+inline std::vector<char>& scratch_buffer(std::size_t size)
+{
+    thread_local std::vector<char> buffer;
+    if (buffer.size() < size)
+        buffer.resize(size);
+    return buffer;
+}
+
+// Collects all regular files below (or at) the given path.
+inline std::vector<fs::path> regular_files(const fs::path& path)
+{
+    std::vector<fs::path> files;
+    if (fs::is_regular_file(path))
+    {
+        files.push_back(path);
+        return files;
+    }
+
+    for (const auto& entry : fs::recursive_directory_iterator(path))
+    {
+        if (entry.is_regular_file())
+            files.push_back(entry.path());
+    }
+    return files;
+}
+
+// Size and modification time of the directory and every entry below it. Two equal states of
+// a tree mean that it was not written in between.
+using TreeState = std::map<fs::path, std::pair<std::uintmax_t, fs::file_time_type>>;
+
+inline TreeState tree_state(const fs::path& dir)
+{
+    TreeState state;
+    state[dir] = {0, fs::last_write_time(dir)};
+    for (const auto& entry : fs::recursive_directory_iterator(dir))
+    {
+        auto& [size, time] = state[entry.path()];
+        if (entry.is_symlink())
+            continue;
+        if (entry.is_regular_file())
+            size = entry.file_size();
+        time = entry.last_write_time();
+    }
+    return state;
+}
+
+#ifdef TD_POSIX
+// Minimal RAII owner of a POSIX file descriptor.
+class FileDescriptor
+{
+  public:
+    explicit FileDescriptor(int fd = -1) : _fd(fd) {}
+    ~FileDescriptor()
+    {
+        if (_fd >= 0)
+            ::close(_fd);
+    }
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    FileDescriptor(FileDescriptor&& other) noexcept : _fd(other._fd) { other._fd = -1; }
+    FileDescriptor& operator=(FileDescriptor&& other) noexcept
+    {
+        std::swap(_fd, other._fd);
+        return *this;
+    }
+
+    int get() const { return _fd; }
+    explicit operator bool() const { return _fd >= 0; }
+
+  private:
+    int _fd;
+};
+
+// Opens the parents of entries given relative to a root directory, component by component
+// with O_NOFOLLOW, so a directory replaced by a symlink is never followed out of the root.
+// The last opened parent is kept, consecutive entries mostly share it.
+class ParentDirectories
+{
+  public:
+    explicit ParentDirectories(int root_fd) : _root_fd(root_fd) {}
+
+    // Returns the descriptor of the parent of relative and sets leaf to the last component.
+    // Returns -1 if a parent is missing, not a directory or a symlink.
+    int open(std::string_view relative, std::string_view& leaf)
+    {
+        auto slash = relative.rfind('/');
+        if (slash == std::string_view::npos)
+        {
+            leaf = relative;
+            return _root_fd;
+        }
+        leaf = relative.substr(slash + 1);
+        std::string_view dir = relative.substr(0, slash);
+        if (_fd && dir == _dir)
+            return _fd.get();
+
+        _fd = FileDescriptor();
+        _dir.clear();
+        FileDescriptor current;
+        std::string component;
+        for (std::size_t start = 0; start <= dir.size();)
+        {
+            std::size_t end = std::min(dir.find('/', start), dir.size());
+            component.assign(dir.substr(start, end - start));
+            start = end + 1;
+            if (component.empty())
+                continue;
+            FileDescriptor next(::openat(current ? current.get() : _root_fd, component.c_str(),
+                                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+            if (!next)
+                return -1;
+            current = std::move(next);
+        }
+        if (!current)
+            return _root_fd;
+        _fd = std::move(current);
+        _dir.assign(dir);
+        return _fd.get();
+    }
+
+  private:
+    int _root_fd;
+    FileDescriptor _fd;
+    std::string _dir;
+};
+
+// Returns the number of bytes of the file referenced by fd that are currently held in the
+// page cache. The file is mapped without being touched and queried page by page via mincore.
+inline std::uintmax_t resident_bytes(int fd, std::uintmax_t size)
+{
+    if (size == 0)
+        return 0;
+
+    void* addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return 0;
+
+#ifdef __APPLE__
+    using mincore_vec_t = char;
+#else
+    using mincore_vec_t = unsigned char;
+#endif
+    std::uintmax_t page_size = static_cast<std::uintmax_t>(::sysconf(_SC_PAGESIZE));
+    std::vector<mincore_vec_t> pages((size + page_size - 1) / page_size);
+
+    std::uintmax_t resident = 0;
+    if (::mincore(addr, size, pages.data()) == 0)
+    {
+        for (std::size_t i = 0; i < pages.size(); ++i)
+        {
+            if (pages[i] & 1)
+                resident += std::min(page_size, size - i * page_size);
+        }
+    }
+
+    ::munmap(addr, size);
+    return resident;
+}
+
+// Asks the kernel to read the given file range into the page cache without blocking.
+inline void advise_willneed(int fd, std::uintmax_t size)
+{
+#if defined(POSIX_FADV_WILLNEED)
+    ::posix_fadvise(fd, 0, static_cast<off_t>(size), POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+    struct radvisory advisory;
+    advisory.ra_offset = 0;
+    advisory.ra_count = static_cast<int>(std::min<std::uintmax_t>(size, INT32_MAX));
+    ::fcntl(fd, F_RDADVISE, &advisory);
+#else
+    (void)fd;
+    (void)size;
+#endif
+}
+
+// Page cache state of a single file in bytes.
+struct PageCacheState
+{
+    std::uintmax_t resident = 0;
+    std::uintmax_t dirty = 0;
+    std::uintmax_t writeback = 0;
+};
+
+// Determines the page cache state of the file referenced by fd. Uses the cachestat syscall
+// (Linux 6.5+) when available, which also reports dirty and writeback pages. Otherwise, or if
+// the system headers do not know the syscall number, falls back to mincore, which only reports
+// resident pages.
+inline PageCacheState page_cache_state(int fd, std::uintmax_t size)
+{
+    PageCacheState state;
+#if defined(__linux__) && (defined(SYS_cachestat) || defined(__NR_cachestat))
+#ifdef SYS_cachestat
+    constexpr long cachestat_syscall = SYS_cachestat;
+#else
+    constexpr long cachestat_syscall = __NR_cachestat;
+#endif
+    static std::atomic<bool> cachestat_available{true};
+    if (cachestat_available)
+    {
+        struct
+        {
+            std::uint64_t off;
+            std::uint64_t len;
+        } range{0, 0};
+        struct
+        {
+            std::uint64_t nr_cache;
+            std::uint64_t nr_dirty;
+            std::uint64_t nr_writeback;
+            std::uint64_t nr_evicted;
+            std::uint64_t nr_recently_evicted;
+        } cstat{};
+
+        if (::syscall(cachestat_syscall, fd, &range, &cstat, 0) == 0)
+        {
+            std::uintmax_t page_size = static_cast<std::uintmax_t>(::sysconf(_SC_PAGESIZE));
+            state.resident = std::min(size, cstat.nr_cache * page_size);
+            state.dirty = std::min(size, cstat.nr_dirty * page_size);
+            state.writeback = std::min(size, cstat.nr_writeback * page_size);
+            return state;
+        }
+        if (errno == ENOSYS)
+            cachestat_available = false;
+    }
+#endif
+    state.resident = resident_bytes(fd, size);
+    return state;
+}
+#endif
+
+// Reads the entries of a single directory into listing, prefixing each name with prefix.
+// Directories found are additionally appended to subdirectories (including the prefix).
+// On Linux entries are read via getdents64 with a large buffer, on other POSIX systems via
+// readdir and elsewhere via std::filesystem.
+inline void read_directory(const fs::path& dir, std::string_view prefix, Listing& listing,
+                           std::pmr::vector<std::pmr::string>& subdirectories)
+{
+#ifdef TD_POSIX
+    auto to_entry_type = [](unsigned char d_type) {
+        switch (d_type)
+        {
+        case DT_REG:
+            return EntryType::file;
+        case DT_DIR:
+            return EntryType::directory;
+        case DT_LNK:
+            return EntryType::symlink;
+        case DT_UNKNOWN:
+            return EntryType::unknown;
+        default:
+            return EntryType::other;
+        }
+    };
+
+    FileDescriptor fd(::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!fd)
+        throw fs::filesystem_error("open", dir, std::error_code(errno, std::system_category()));
+
+    auto add = [&](const char* name, unsigned char d_type, std::uint64_t inode) {
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            return;
+
+        EntryType type = to_entry_type(d_type);
+        if (type == EntryType::unknown)
+        {
+            struct stat st;
+            if (::fstatat(fd.get(), name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            {
+                type = S_ISREG(st.st_mode)   ? EntryType::file
+                       : S_ISDIR(st.st_mode) ? EntryType::directory
+                       : S_ISLNK(st.st_mode) ? EntryType::symlink
+                                             : EntryType::other;
+            }
+        }
+
+        listing.append(prefix, name, type, inode);
+        if (type == EntryType::directory)
+            subdirectories.emplace_back(prefix).append(name);
+    };
+
+#ifdef __linux__
+    struct linux_dirent64
+    {
+        std::uint64_t d_ino;
+        std::int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    std::vector<char>& buffer = scratch_buffer(256 * 1024);
+    for (;;)
+    {
+        long read = ::syscall(SYS_getdents64, fd.get(), buffer.data(), buffer.size());
+        if (read < 0)
+            throw fs::filesystem_error("getdents64", dir,
+                                       std::error_code(errno, std::system_category()));
+        if (read == 0)
+            break;
+
+        for (long offset = 0; offset < read;)
+        {
+            auto* entry = reinterpret_cast<linux_dirent64*>(buffer.data() + offset);
+            add(entry->d_name, entry->d_type, entry->d_ino);
+            offset += entry->d_reclen;
+        }
+    }
+#else
+    DIR* stream = ::fdopendir(::dup(fd.get()));
+    if (!stream)
+        throw fs::filesystem_error("opendir", dir, std::error_code(errno, std::system_category()));
+
+    while (struct dirent* entry = ::readdir(stream))
+        add(entry->d_name, entry->d_type, entry->d_ino);
+    ::closedir(stream);
+#endif
+#else
+    for (const auto& entry : fs::directory_iterator(dir))
+    {
+        auto status = entry.symlink_status();
+        EntryType type = fs::is_regular_file(status) ? EntryType::file
+                         : fs::is_directory(status) ? EntryType::directory
+                         : fs::is_symlink(status)   ? EntryType::symlink
+                                                    : EntryType::other;
+
+        std::string name = entry.path().filename().string();
+        listing.append(prefix, name, type, 0);
+        if (type == EntryType::directory)
+            subdirectories.emplace_back(prefix).append(name);
+    }
+#endif
+}
+
+// Adds all ancestors of the given relative path to directories.
+inline void add_parent_directories(std::pmr::set<fs::path>& directories, const fs::path& path)
+{
+    for (fs::path dir = path.parent_path(); !dir.empty(); dir = dir.parent_path())
+    {
+        if (!directories.insert(dir).second)
+            break;
+    }
+}
+
+// Creates the given directories relative to base, std::set orders parents before their children.
+// on_created is called for each directory that did not exist before.
+template <typename OnCreated>
+void create_directories(const fs::path& base, const std::pmr::set<fs::path>& directories,
+                        OnCreated on_created)
+{
+    for (const auto& dir : directories)
+    {
+        if (fs::create_directory(base / dir))
+            on_created(dir);
+    }
+}
+
+// Ensures the given path is relative and does not escape the base directory.
+inline void validate_relative_path(const fs::path& path)
+{
+    bool escapes = false;
+    for (const auto& part : path)
+        escapes = escapes || part == "..";
+
+    if (path.empty() || path.has_root_path() || escapes)
+        throw std::invalid_argument("path '" + path.string() +
+                                    "' is not relative to the temporary directory");
+}
+
+// Budget of a synchronous removal, see Config::set_cleanup_budget.
+struct RemovalBudget
+{
+    RemovalBudget(std::uint64_t budget_us, std::size_t max_entries)
+        : deadline(std::chrono::steady_clock::now() + std::chrono::microseconds(budget_us)),
+          timed(budget_us > 0), remaining(max_entries > 0 ? max_entries : SIZE_MAX)
+    {
+    }
+
+    // Returns true if the budget allows to remove one more entry and accounts for it.
+    bool spend()
+    {
+        if (exhausted || remaining == 0 || (timed && std::chrono::steady_clock::now() >= deadline))
+        {
+            exhausted = true;
+            return false;
+        }
+        --remaining;
+        return true;
+    }
+
+    std::chrono::steady_clock::time_point deadline;
+    bool timed;
+    std::size_t remaining;
+    bool exhausted = false;
+};
+
+#ifdef TD_POSIX
+// Throws a filesystem_error describing the current errno.
+[[noreturn]] inline void throw_errno(const char* operation, const fs::path& path)
+{
+    throw fs::filesystem_error(operation, path, std::error_code(errno, std::system_category()));
+}
+
+// Creates or truncates a file relative to dir_fd and writes its content.
+inline void write_file_at(int dir_fd, const fs::path& base, const FileSpec& file)
+{
+    FileDescriptor fd(
+        ::openat(dir_fd, file.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666));
+    if (!fd)
+        throw_errno("open", base / file.path);
+
+    const char* data = file.content.data();
+    std::size_t remaining = file.content.size();
+    while (remaining > 0)
+    {
+        ssize_t written = ::write(fd.get(), data, remaining);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0)
+            throw_errno("write", base / file.path);
+        data += written;
+        remaining -= static_cast<std::size_t>(written);
+    }
+}
+
+inline bool permission_denied(int error) { return error == EACCES || error == EPERM; }
+
+inline std::uintmax_t remove_entry_at(int parent_fd, const char* name, const fs::path& path,
+                                      bool is_directory, bool repair_parent,
+                                      RemovalBudget* budget = nullptr);
+
+// Removes all entries of the open directory dir_fd in a single pass, see remove_entry_at.
+inline std::uintmax_t remove_contents_at(int dir_fd, const fs::path& path,
+                                         RemovalBudget* budget = nullptr)
+{
+    DIR* stream = ::fdopendir(::dup(dir_fd));
+    if (!stream)
+        throw_errno("opendir", path);
+    std::unique_ptr<DIR, int (*)(DIR*)> guard(stream, ::closedir);
+
+    std::uintmax_t removed = 0;
+    while (struct dirent* entry = ::readdir(stream))
+    {
+        const char* name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+
+        bool is_directory = entry->d_type == DT_DIR;
+        struct stat st;
+        if (entry->d_type == DT_UNKNOWN && ::fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            is_directory = S_ISDIR(st.st_mode);
+        removed += remove_entry_at(dir_fd, name, path / name, is_directory, true, budget);
+        if (budget && budget->exhausted)
+            break;
+    }
+    return removed;
+}
+
+// Removes the entry name of the directory parent_fd recursively and returns the number of
+// removed entries. Missing permissions are repaired inline: a directory that can not be opened
+// is made accessible via fchmodat on its parent, a directory whose entries can not be unlinked
+// via fchmod (only if repair_parent), and the failed call is retried once. Read-only subtrees
+// are therefore removed in the same walk, without a chmod pass up front. With a budget, the
+// walk stops as soon as it is exhausted and leaves the remaining entries in place.
+inline std::uintmax_t remove_entry_at(int parent_fd, const char* name, const fs::path& path,
+                                      bool is_directory, bool repair_parent,
+                                      RemovalBudget* budget)
+{
+    std::uintmax_t removed = 0;
+    if (is_directory)
+    {
+        int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+        FileDescriptor fd(::openat(parent_fd, name, flags));
+        if (!fd && permission_denied(errno) && ::fchmodat(parent_fd, name, S_IRWXU, 0) == 0)
+            fd = FileDescriptor(::openat(parent_fd, name, flags));
+        if (!fd && errno == ENOENT)
+            return 0;
+        if (!fd)
+            throw_errno("open", path);
+        removed += remove_contents_at(fd.get(), path, budget);
+    }
+    if (budget && !budget->spend())
+        return removed;
+
+    int flags = is_directory ? AT_REMOVEDIR : 0;
+    if (::unlinkat(parent_fd, name, flags) != 0)
+    {
+        int error = errno;
+        if (error == ENOENT)
+            return removed;
+        if (!repair_parent || !permission_denied(error) || ::fchmod(parent_fd, S_IRWXU) != 0 ||
+            ::unlinkat(parent_fd, name, flags) != 0)
+        {
+            errno = error;
+            throw_errno(is_directory ? "rmdir" : "unlink", path);
+        }
+    }
+    return removed + 1;
+}
+#endif
+
+// Removes the given file or directory tree and returns the number of removed entries, like
+// fs::remove_all. On POSIX systems permissions within the tree are repaired inline (see
+// remove_entry_at), the parent of path is never modified. The budget is only respected on
+// POSIX systems.
+inline std::uintmax_t remove_tree(const fs::path& path, RemovalBudget* budget = nullptr)
+{
+#ifdef TD_POSIX
+    fs::path parent = path.has_parent_path() ? path.parent_path() : fs::path(".");
+    FileDescriptor parent_fd(::open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!parent_fd)
+        throw_errno("open", parent);
+
+    struct stat st;
+    if (::fstatat(parent_fd.get(), path.filename().c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        if (errno == ENOENT)
+            return 0;
+        throw_errno("stat", path);
+    }
+    return remove_entry_at(parent_fd.get(), path.filename().c_str(), path, S_ISDIR(st.st_mode),
+                           false, budget);
+#else
+    (void)budget;
+    return fs::remove_all(path);
+#endif
+}
+
+// Issues read-ahead for a single file and accumulates its statistics.
+inline void prefetch_file(const fs::path& file, bool wait, std::atomic<std::uintmax_t>& total,
+                          std::atomic<std::uintmax_t>& before, std::atomic<std::uintmax_t>& after)
+{
+#ifdef TD_POSIX
+    FileDescriptor fd(::open(file.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat st;
+    if (!fd || ::fstat(fd.get(), &st) != 0)
+        return;
+
+    std::uintmax_t size = static_cast<std::uintmax_t>(st.st_size);
+    total += size;
+    before += resident_bytes(fd.get(), size);
+    advise_willneed(fd.get(), size);
+
+    if (!wait)
+        return;
+
+    std::vector<char>& buffer = scratch_buffer(1 << 20);
+    off_t offset = 0;
+    ssize_t n;
+    while ((n = ::pread(fd.get(), buffer.data(), buffer.size(), offset)) > 0)
+        offset += n;
+    after += resident_bytes(fd.get(), size);
+#else
+    std::error_code ec;
+    std::uintmax_t size = fs::file_size(file, ec);
+    if (ec)
+        return;
+
+    total += size;
+    if (!wait)
+        return;
+
+    std::ifstream in(file, std::ios::binary);
+    std::vector<char>& buffer = scratch_buffer(1 << 20);
+    while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0)
+    {
+    }
+#endif
+}
+
+// Returns a small id of the calling thread, unique within the process.
+inline std::uint32_t trace_thread_id()
+{
+    static std::atomic<std::uint32_t> next_id{0};
+    thread_local std::uint32_t id = next_id++;
+    return id;
+}
+
+// Records one operation into a trace, nothing is done without recorder.
+class TraceScope
+{
+  public:
+    TraceScope(TraceRecorder* recorder, std::uint32_t dir, TraceOp op) : _recorder(recorder)
+    {
+        if (!_recorder)
+            return;
+        _event.timestamp_ns = _recorder->now_ns();
+        _event.thread = trace_thread_id();
+        _event.dir = dir;
+        _event.op = op;
+    }
+
+    // Records the completed operation with its sizes.
+    void finish(std::uint64_t count = 0, std::uint64_t bytes = 0)
+    {
+        if (!_recorder)
+            return;
+        _event.duration_ns = _recorder->now_ns() - _event.timestamp_ns;
+        _event.count = count;
+        _event.bytes = bytes;
+        _recorder->record(_event);
+    }
+
+  private:
+    TraceRecorder* _recorder;
+    TraceEvent _event;
+};
+
+inline void append_varint(std::vector<unsigned char>& buffer, std::uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        buffer.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<unsigned char>(value));
+}
+
+inline std::uint64_t read_varint(const unsigned char*& data, const unsigned char* end)
+{
+    std::uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (data == end)
+            throw std::runtime_error("truncated trace event");
+        unsigned char byte = *data++;
+        value |= std::uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return value;
+    }
+    throw std::runtime_error("invalid varint in trace");
+}
+
+// magic and version at the start of a trace file
+constexpr char trace_magic[8] = {'T', 'D', 'T', 'R', 'A', 'C', 'E', '1'};
+
+// Measures the phases of an operation, the clock is only read if timing is enabled.
+class PhaseTimer
+{
+  public:
+    explicit PhaseTimer(bool enabled) : _enabled(enabled)
+    {
+        if (_enabled)
+            _last = std::chrono::steady_clock::now();
+    }
+
+    // Returns the microseconds elapsed since the previous lap.
+    std::uint64_t lap()
+    {
+        if (!_enabled)
+            return 0;
+        auto now = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - _last);
+        _last = now;
+        return static_cast<std::uint64_t>(elapsed.count());
+    }
+
+  private:
+    bool _enabled;
+    std::chrono::steady_clock::time_point _last;
+};
+
+// Returns true if the given cleanup policy allows to remove a directory right now.
+inline bool cleanup_allowed(Cleanup cleanup)
+{
+    return cleanup == Cleanup::always ||
+           (cleanup == Cleanup::on_success && std::uncaught_exceptions() <= 0);
+}
+
+// Removes all entries contained in the given directory, the directory itself is kept.
+// Returns the number of removed entries.
+inline std::uintmax_t remove_contents(const fs::path& dir, std::size_t threads = 1)
+{
+    std::vector<fs::path> entries;
+    for (const auto& entry : fs::directory_iterator(dir))
+        entries.push_back(entry.path());
+
+    std::atomic<std::uintmax_t> removed{0};
+    parallel_for(entries.size(), threads,
+                 [&](std::size_t i) { removed += remove_tree(entries[i]); });
+    return removed;
+}
+
+// Turns an arbitrary name (e.g. a test name) into a portable directory name.
+inline std::string sanitize_name(std::string_view name, std::size_t max_length = 64)
+{
+    std::string result;
+    for (char c : name.substr(0, max_length))
+    {
+        bool portable = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                        (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.';
+        result.push_back(portable ? c : '_');
+    }
+    return result.empty() ? "lease" : result;
+}
+
+inline long process_id()
+{
+#if defined(TD_POSIX)
+    return static_cast<long>(::getpid());
+#elif defined(_WIN32)
+    return static_cast<long>(::_getpid());
+#else
+    return 0;
+#endif
+}
+
+// Returns the start time of the process in clock ticks since boot as read from
+// /proc/<pid>/stat, or 0 if there is no such process or /proc is not available.
+inline unsigned long long process_start_time(long pid)
+{
+#if defined(__linux__)
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line))
+        return 0;
+    // the command name in parentheses may contain spaces, the state (field 3) follows the last ')'
+    std::size_t end = line.rfind(')');
+    if (end == std::string::npos)
+        return 0;
+    std::istringstream fields(line.substr(end + 1));
+    std::string field;
+    for (int i = 3; i < 22; ++i)
+        fields >> field;
+    unsigned long long start = 0;
+    fields >> start;
+    return start;
+#else
+    (void)pid;
+    return 0;
+#endif
+}
+
+// Returns the inode of the pid namespace of this process, or 0 if /proc is not available.
+inline unsigned long long pid_namespace()
+{
+#if defined(__linux__)
+    std::error_code ec;
+    std::string link = fs::read_symlink("/proc/self/ns/pid", ec).string(); // "pid:[4026531836]"
+    std::size_t begin = link.find('[');
+    if (ec || begin == std::string::npos)
+        return 0;
+    return std::strtoull(link.c_str() + begin + 1, nullptr, 10);
+#else
+    return 0;
+#endif
+}
+
+// Returns true only if /proc confirms that the process identified by pid, start time and pid
+// namespace has exited: no process with the pid exists or the pid was reused by a later process.
+// Processes of other pid namespaces and platforms without /proc are never confirmed as exited.
+inline bool process_exited(long pid, unsigned long long start, unsigned long long pid_ns)
+{
+    if (pid <= 0 || start == 0 || pid_ns == 0 || pid_ns != pid_namespace() ||
+        process_start_time(process_id()) == 0)
+        return false;
+    return process_start_time(pid) != start;
+}
+
+// marker file of a session containing kept temporary directories
+constexpr const char* session_keep_marker = ".keep";
+
+// Renames a session aside, so it disappears from the root at once, and removes it.
+inline void remove_session(const fs::path& session)
+{
+    fs::path removing = session;
+    if (session.extension() != ".removing")
+    {
+        removing += ".removing";
+        fs::rename(session, removing);
+    }
+    remove_contents(removing, 0);
+    fs::remove(removing);
+}
+
+// Registry of the session directories of this process, removed at process exit.
+class SessionRegistry
+{
+  public:
+    static SessionRegistry& instance()
+    {
+        static SessionRegistry registry;
+        return registry;
+    }
+
+    ~SessionRegistry()
+    {
+        for (const Session& session : _sessions)
+        {
+            try
+            {
+                if (!session.kept)
+                    remove_session(session.path);
+            }
+            catch (const std::exception&)
+            {
+                // do nothing as rethrowing is not allowed in destructor,
+                // the session is reaped by a later process
+            }
+        }
+    }
+
+    // Returns the session directory for the given configuration, it is created on first use.
+    fs::path session_path(const Config& config)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        fs::path path = config.root_path / (config.temp_dir_prefix + "_session_" +
+                                            std::to_string(process_id()) + "_" +
+                                            std::to_string(_start) + "_" +
+                                            std::to_string(_pid_namespace));
+        for (const Session& session : _sessions)
+            if (session.path == path)
+                return path;
+
+        try
+        {
+            TempDir::reap_sessions(config);
+        }
+        catch (const std::exception&)
+        {
+            // reaping is best effort and must not prevent a new session
+        }
+        fs::create_directories(path);
+        _sessions.push_back({path, false});
+        return path;
+    }
+
+    // Marks the session as containing kept temporary directories, it is not removed at exit.
+    void keep(const fs::path& path)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (Session& session : _sessions)
+        {
+            if (session.path == path && !session.kept)
+            {
+                std::ofstream(path / session_keep_marker);
+                session.kept = true;
+            }
+        }
+    }
+
+  private:
+    struct Session
+    {
+        fs::path path;
+        bool kept;
+    };
+
+    // The session name identifies this process by pid, start time and pid namespace, so that
+    // reap_sessions can tell it from a later process reusing the pid. Without /proc the start
+    // time falls back to the wall clock, such sessions are never reaped automatically.
+    SessionRegistry() : _start(process_start_time(process_id())), _pid_namespace(pid_namespace())
+    {
+        if (_start == 0)
+            _start = static_cast<unsigned long long>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                    .count());
+    }
+
+    std::mutex _mutex;
+    std::vector<Session> _sessions;
+    unsigned long long _start;
+    unsigned long long _pid_namespace;
+};
+
+// Returns true if the temporary directory is nested in a session.
+inline bool in_session(const Config& config)
+{
+    return config.session && config.cleanup != Cleanup::never;
+}
+
+// Returns true if the temporary directory is nested in a generation of the root path.
+inline bool in_generation(const Config& config)
+{
+    return (config.generation_max_dirs > 0 || config.generation_max_age_s > 0) &&
+           !in_session(config);
+}
+
+constexpr const char* generation_prefix = "gen-";
+
+// Registry of the current generation per root path used by this process.
+// Retired generations are removed by a background thread as soon as they are empty.
+class GenerationRegistry
+{
+  public:
+    static GenerationRegistry& instance()
+    {
+        static GenerationRegistry registry;
+        return registry;
+    }
+
+    ~GenerationRegistry()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        if (_worker.joinable())
+            _worker.join();
+    }
+
+    // Returns the generation directory for a new temporary directory below the root path,
+    // rotating to the next generation if the current one is exhausted.
+    fs::path generation_path(const Config& config)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto now = std::chrono::steady_clock::now();
+        auto it = _roots.find(config.root_path);
+        if (it == _roots.end())
+            it = _roots.emplace(config.root_path, Generation{start_generation(config.root_path),
+                                                             0, now})
+                     .first;
+
+        Generation& generation = it->second;
+        bool full = config.generation_max_dirs > 0 &&
+                    generation.created >= config.generation_max_dirs;
+        bool old = config.generation_max_age_s > 0 &&
+                   now - generation.start >= std::chrono::seconds(config.generation_max_age_s);
+        if (full || old)
+        {
+            // generations created by other processes may still be in use by them
+            fs::path current = path(config.root_path, generation.number);
+            if (_owned.count(current))
+                retire(current);
+            generation = {generation.number + 1, 0, now};
+        }
+        ++generation.created;
+        return path(config.root_path, generation.number);
+    }
+
+    // Creates a temporary directory in its generation. The generation directory is created if
+    // it does not exist, also if another process removed it concurrently, and is then owned by
+    // this process: only owned generations are retired.
+    void create_in_generation(const fs::path& dir)
+    {
+        for (int attempt = 0;; ++attempt)
+        {
+            std::error_code ec;
+            if (fs::create_directory(dir, ec) || !ec)
+                return;
+            if (ec != std::errc::no_such_file_or_directory || attempt == 2)
+                throw fs::filesystem_error("create_directory", dir, ec);
+            if (fs::create_directories(dir.parent_path()))
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _owned.insert(dir.parent_path());
+            }
+        }
+    }
+
+    // Notifies the registry that a temporary directory of the given generation was removed.
+    void released(const fs::path& generation)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_retired.count(generation))
+        {
+            _pending = true;
+            _wake.notify_all();
+        }
+    }
+
+  private:
+    struct Generation
+    {
+        std::uint64_t number;
+        std::size_t created;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    GenerationRegistry() = default;
+
+    static fs::path path(const fs::path& root, std::uint64_t number)
+    {
+        return root / (generation_prefix + std::to_string(number));
+    }
+
+    // Continues after the newest generation of the root. Older generations are left alone,
+    // other processes may still use them.
+    std::uint64_t start_generation(const fs::path& root)
+    {
+        std::vector<std::uint64_t> numbers;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(root, ec))
+        {
+            std::string name = entry.path().filename().string();
+            if (name.rfind(generation_prefix, 0) != 0)
+                continue;
+            std::string digits = name.substr(std::char_traits<char>::length(generation_prefix));
+            if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos)
+                continue;
+            // names of more than 20 digits do not fit and are skipped
+            errno = 0;
+            std::uint64_t number = std::strtoull(digits.c_str(), nullptr, 10);
+            if (errno != ERANGE)
+                numbers.push_back(number);
+        }
+        return numbers.empty() ? 0 : *std::max_element(numbers.begin(), numbers.end());
+    }
+
+    // Schedules removal of the generation, requires the lock.
+    void retire(const fs::path& generation)
+    {
+        _retired.insert(generation);
+        _pending = true;
+        if (!_worker.joinable())
+            _worker = std::thread([this] { remove_retired(); });
+        _wake.notify_all();
+    }
+
+    // Removes retired generations once they are empty, removing a non-empty directory fails
+    // cheaply and is retried when one of its temporary directories is released.
+    void remove_retired()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;)
+        {
+            _wake.wait(lock, [this] { return _stop || _pending; });
+            if (_stop)
+                return;
+            _pending = false;
+
+            std::vector<fs::path> retired(_retired.begin(), _retired.end());
+            lock.unlock();
+            std::vector<fs::path> removed;
+            for (const auto& generation : retired)
+            {
+                std::error_code ec;
+                if (fs::remove(generation, ec) || !ec)
+                    removed.push_back(generation);
+            }
+            lock.lock();
+            for (const auto& generation : removed)
+            {
+                _retired.erase(generation);
+                _owned.erase(generation);
+            }
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::map<fs::path, Generation> _roots;
+    std::set<fs::path> _owned;
+    std::set<fs::path> _retired;
+    bool _pending = false;
+    bool _stop = false;
+    std::thread _worker;
+};
+
+// Removes the remains of budgeted cleanups (see Config::set_cleanup_budget) in a background
+// thread. Pending removals are finished before the process exits.
+class BackgroundRemover
+{
+  public:
+    static BackgroundRemover& instance()
+    {
+        static BackgroundRemover remover;
+        return remover;
+    }
+
+    ~BackgroundRemover()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        if (_worker.joinable())
+            _worker.join();
+    }
+
+    // Queues the directory tree for removal, the generation it belonged to (if any) is
+    // released afterwards.
+    void remove(fs::path path, fs::path generation)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back({std::move(path), std::move(generation)});
+        if (!_worker.joinable())
+            _worker = std::thread([this] { run(); });
+        _wake.notify_all();
+    }
+
+  private:
+    struct Job
+    {
+        fs::path path;
+        fs::path generation;
+    };
+
+    // The worker releases generations while draining the queue at exit, so the registry is
+    // constructed first and therefore destroyed after the remover.
+    BackgroundRemover() { GenerationRegistry::instance(); }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;)
+        {
+            _wake.wait(lock, [this] { return _stop || !_queue.empty(); });
+            if (_queue.empty())
+                return;
+
+            Job job = std::move(_queue.front());
+            _queue.erase(_queue.begin());
+            lock.unlock();
+            try
+            {
+                remove_tree(job.path);
+            }
+            catch (const std::exception&)
+            {
+                // the remains stay as <name>.removing, there is no caller to report to
+            }
+            if (!job.generation.empty())
+                GenerationRegistry::instance().released(job.generation);
+            lock.lock();
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::vector<Job> _queue;
+    bool _stop = false;
+    std::thread _worker;
+};
+
+// synchronous removal predicted to take longer is deferred by CleanupStrategy::adaptive
+constexpr std::uint64_t adaptive_defer_threshold_us = 20'000;
+
+// number of files of the probe tree calibrating a CleanupCostModel
+constexpr std::size_t cleanup_probe_files = 64;
+
+// name of the probe tree, created inside the temporary directory being cleaned up
+constexpr const char* cleanup_probe_name = ".td_cleanup_probe";
+
+// Costs of the cleanup strategies on one filesystem.
+struct CleanupCostModel
+{
+    double serial_ns_per_entry = 0;
+    double parallel_ns_per_entry = 0;
+    double parallel_overhead_ns = 0; // starting and joining the worker threads
+    bool parallel_available = false; // more than one hardware thread
+    double deferred_ns = 0;          // renaming aside, independent of the tree size
+
+    // Returns the cheapest strategy for a tree of the given size. Deferring is only chosen if
+    // synchronous removal would exceed the threshold, small trees are removed deterministically.
+    CleanupStrategy choose(double entries, double defer_threshold_ns) const
+    {
+        double serial = entries * serial_ns_per_entry;
+        double parallel = parallel_overhead_ns + entries * parallel_ns_per_entry;
+        bool use_parallel = parallel_available && parallel < serial;
+        double synchronous = use_parallel ? parallel : serial;
+        if (synchronous > defer_threshold_ns && deferred_ns < synchronous)
+            return CleanupStrategy::deferred;
+        return use_parallel ? CleanupStrategy::parallel : CleanupStrategy::serial;
+    }
+};
+
+inline double elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count());
+}
+
+// Creates cleanup_probe_files empty files in 8 subdirectories of probe.
+inline void create_probe_tree(const fs::path& probe)
+{
+    for (std::size_t i = 0; i < cleanup_probe_files; ++i)
+    {
+        fs::path dir = probe / ("d" + std::to_string(i % 8));
+        if (i < 8)
+            fs::create_directories(dir);
+        std::ofstream(dir / ("f" + std::to_string(i)));
+    }
+}
+
+// Calibrates a cost model in a probe tree created at the given path, removes the probe.
+inline CleanupCostModel probe_cleanup_costs(const fs::path& probe)
+{
+    CleanupCostModel model;
+    double entries = double(cleanup_probe_files + 8 + 1);
+
+    create_probe_tree(probe);
+    auto start = std::chrono::steady_clock::now();
+    remove_tree(probe);
+    model.serial_ns_per_entry = elapsed_ns(start) / entries;
+
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    model.parallel_available = threads > 1;
+    if (model.parallel_available)
+    {
+        start = std::chrono::steady_clock::now();
+        parallel_for(threads, threads, [](std::size_t) {});
+        model.parallel_overhead_ns = elapsed_ns(start);
+
+        create_probe_tree(probe);
+        start = std::chrono::steady_clock::now();
+        remove_contents(probe, threads);
+        fs::remove(probe);
+        model.parallel_ns_per_entry =
+            std::max(0.0, elapsed_ns(start) - model.parallel_overhead_ns) / entries;
+    }
+
+    fs::create_directories(probe / "d");
+    start = std::chrono::steady_clock::now();
+    fs::rename(probe / "d", probe / "d.removing");
+    model.deferred_ns = elapsed_ns(start);
+    remove_tree(probe);
+    return model;
+}
+
+// Cache of the cost models per device, each device is probed once per process.
+class CleanupCostModels
+{
+  public:
+    static CleanupCostModels& instance()
+    {
+        static CleanupCostModels models;
+        return models;
+    }
+
+    // Returns the model of the filesystem of dir. An unknown filesystem is probed once inside
+    // dir, the directory about to be removed, so a probe interrupted by a crash is left in a
+    // temporary directory and not in the shared root. Calls for a filesystem whose probe is
+    // still running and probes that failed (e.g. dir already contains an entry of the probe's
+    // name) use the default model, which selects serial removal.
+    CleanupCostModel model(const fs::path& dir)
+    {
+        std::uint64_t device = 0;
+#ifdef TD_POSIX
+        struct stat st;
+        if (::stat(dir.c_str(), &st) == 0)
+            device = static_cast<std::uint64_t>(st.st_dev);
+#endif
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto [it, inserted] = _models.try_emplace(device);
+            if (!inserted)
+                return it->second;
+        }
+
+        CleanupCostModel model;
+        fs::path probe = dir / cleanup_probe_name;
+        bool created = false;
+        try
+        {
+            // an existing entry of the same name belongs to the user and is left alone
+            created = fs::create_directory(probe);
+            if (created)
+                model = probe_cleanup_costs(probe);
+        }
+        catch (const std::exception&)
+        {
+            std::error_code ec;
+            if (created)
+                fs::remove_all(probe, ec);
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _models[device] = model;
+        return model;
+    }
+
+  private:
+    CleanupCostModels() = default;
+
+    std::mutex _mutex;
+    std::map<std::uint64_t, CleanupCostModel> _models;
+};
+
+// Estimates the number of entries of the tree with Knuth's estimator: the entry counts along
+// a random path from the root, each weighted by the product of the branching factors above it,
+// are an unbiased estimate of the tree size. A few paths are averaged, so only a handful of
+// directories is read regardless of the tree size.
+inline double estimate_tree_size(const fs::path& dir, std::size_t paths = 8)
+{
+    std::minstd_rand random(
+        static_cast<unsigned>(std::chrono::steady_clock::now().time_since_epoch().count()));
+    double total = 0;
+    std::vector<fs::path> subdirectories;
+    for (std::size_t path = 0; path < paths; ++path)
+    {
+        fs::path node = dir;
+        double weight = 1;
+        for (std::size_t depth = 0; depth < 64; ++depth)
+        {
+            std::size_t count = 0;
+            subdirectories.clear();
+            std::error_code ec;
+            for (const auto& entry : fs::directory_iterator(node, ec))
+            {
+                ++count;
+                if (entry.symlink_status(ec).type() == fs::file_type::directory)
+                    subdirectories.push_back(entry.path());
+            }
+            total += weight * double(count);
+            if (subdirectories.empty())
+            {
+                // every path of a flat directory is the same
+                if (depth == 0)
+                    return total / double(path + 1);
+                break;
+            }
+            weight *= double(subdirectories.size());
+            node = subdirectories[random() % subdirectories.size()];
+        }
+    }
+    return total / double(paths);
+}
+
+// statfs magic numbers of the filesystems reported by TempDir::inspect_root
+constexpr std::uint32_t overlayfs_magic = 0x794c7630;
+constexpr std::uint32_t aufs_magic = 0x61756673;
+
+// Returns the name of the filesystem with the given statfs magic number, empty if unknown.
+inline const char* filesystem_name(std::uint32_t magic)
+{
+    switch (magic)
+    {
+    case overlayfs_magic:
+        return "overlay";
+    case aufs_magic:
+        return "aufs";
+    case 0x01021994:
+        return "tmpfs";
+    case 0xef53:
+        return "ext4";
+    case 0x58465342:
+        return "xfs";
+    case 0x9123683e:
+        return "btrfs";
+    case 0x6969:
+        return "nfs";
+    default:
+        return "";
+    }
+}
+
+// Replaces the octal escapes of mountinfo paths (e.g. \040 for a space).
+inline std::string unescape_mount_path(const std::string& path)
+{
+    std::string result;
+    for (std::size_t i = 0; i < path.size(); ++i)
+    {
+        bool escape = path[i] == '\\' && i + 3 < path.size() &&
+                      path.find_first_not_of("01234567", i + 1) >= i + 4;
+        if (escape)
+        {
+            result.push_back(static_cast<char>(std::stoi(path.substr(i + 1, 3), nullptr, 8)));
+            i += 3;
+        }
+        else
+        {
+            result.push_back(path[i]);
+        }
+    }
+    return result;
+}
+
+// Returns the mount point and filesystem type of the mount containing the absolute path,
+// read from a /proc/self/mountinfo table. Later mounts on the same mount point hide earlier ones.
+inline std::pair<fs::path, std::string> find_mount(std::istream& mountinfo, const fs::path& path)
+{
+    std::pair<fs::path, std::string> result;
+    std::size_t best = 0;
+    std::string generic = path.generic_string();
+    std::string line;
+    while (std::getline(mountinfo, line))
+    {
+        // id parent major:minor root mount_point options [optional fields] - type source options
+        std::istringstream fields(line);
+        std::string id, parent, device, root, mount_point, field, type;
+        fields >> id >> parent >> device >> root >> mount_point;
+        while (fields >> field && field != "-")
+        {
+        }
+        if (!(fields >> type))
+            continue;
+
+        mount_point = unescape_mount_path(mount_point);
+        bool contains = mount_point == "/" || generic == mount_point ||
+                        generic.compare(0, mount_point.size() + 1, mount_point + "/") == 0;
+        if (contains && mount_point.size() >= best)
+        {
+            best = mount_point.size();
+            result = {mount_point, type};
+        }
+    }
+    return result;
+}
+
+inline bool writable_directory(const fs::path& path)
+{
+    std::error_code ec;
+    if (!fs::is_directory(path, ec))
+        return false;
+#ifdef TD_POSIX
+    return ::access(path.c_str(), W_OK | X_OK) == 0;
+#else
+    return true;
+#endif
+}
+
+// Detects the filesystem of a root path, see TempDir::inspect_root.
+inline RootInfo inspect_root(const fs::path& path, const fs::path& mountinfo)
+{
+    RootInfo info;
+    info.path = path;
+#ifdef __linux__
+    struct statfs st;
+    if (::statfs(path.c_str(), &st) == 0)
+    {
+        auto magic = static_cast<std::uint32_t>(st.f_type);
+        info.filesystem = filesystem_name(magic);
+        info.container_layer = magic == overlayfs_magic || magic == aufs_magic;
+    }
+
+    std::ifstream in(mountinfo);
+    std::error_code ec;
+    fs::path absolute = fs::weakly_canonical(fs::absolute(path, ec), ec);
+    auto [mount_point, type] = find_mount(in, absolute);
+    if (!type.empty())
+    {
+        info.mount_point = mount_point;
+        info.filesystem = type;
+        info.container_layer = info.container_layer || type == "overlay" || type == "aufs";
+    }
+#elif defined(__APPLE__)
+    (void)mountinfo;
+    struct statfs st;
+    if (::statfs(path.c_str(), &st) == 0)
+    {
+        info.mount_point = st.f_mntonname;
+        info.filesystem = st.f_fstypename;
+    }
+#else
+    (void)mountinfo;
+#endif
+    return info;
+}
+
+// Cache of inspected root paths, the filesystem of a root does not change while it is in use.
+class RootInfoCache
+{
+  public:
+    static RootInfoCache& instance()
+    {
+        static RootInfoCache cache;
+        return cache;
+    }
+
+    RootInfo get(const fs::path& path, const fs::path& mountinfo)
+    {
+        std::string key = path.string() + '\n' + mountinfo.string();
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _infos.find(key);
+        if (it == _infos.end())
+            it = _infos.emplace(key, inspect_root(path, mountinfo)).first;
+        return it->second;
+    }
+
+  private:
+    RootInfoCache() = default;
+
+    std::mutex _mutex;
+    std::map<std::string, RootInfo> _infos;
+};
+
+} // namespace detail
+
+TD_INLINE void Listing::sort()
+{
+    std::pmr::vector<std::size_t> order(size(), memory_resource());
+    for (std::size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(),
+              [this](std::size_t a, std::size_t b) { return name(a) < name(b); });
+
+    Listing sorted(memory_resource());
+    sorted._names.reserve(_names.size());
+    sorted._offsets.reserve(_offsets.size());
+    sorted._types.reserve(_types.size());
+    sorted._inodes.reserve(_inodes.size());
+    for (std::size_t index : order)
+        sorted.append({}, name(index), type(index), inode(index));
+    *this = std::move(sorted);
+}
+
+// Journal of the entries created by the library in a temporary directory.
+// Names are relative to the temporary directory and stored null terminated in an arena,
+// so they can be passed to unlinkat directly.
+struct TempDir::Journal
+{
+    struct Entry
+    {
+        const fs::path::value_type* name;
+        bool is_directory;
+    };
+
+    using Name = std::basic_string_view<fs::path::value_type>;
+
+    explicit Journal(std::pmr::memory_resource* upstream)
+        : arena(upstream), entries(&arena), names(&arena)
+    {
+    }
+
+    // Records an entry created by the library, so cleanup can remove it without scanning.
+    // Entries written again are recorded once, the journal grows with the distinct paths only.
+    void record(const fs::path& relative_path, bool is_directory)
+    {
+        using Char = fs::path::value_type;
+        const auto& native = relative_path.native();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (names.find(Name(native)) != names.end())
+            return;
+        auto* name = static_cast<Char*>(
+            arena.allocate((native.size() + 1) * sizeof(Char), alignof(Char)));
+        std::copy(native.begin(), native.end(), name);
+        name[native.size()] = 0;
+        entries.push_back({name, is_directory});
+        names.insert(Name(name, native.size()));
+    }
+
+    // Forgets all entries and releases the arena.
+    void clear()
+    {
+        std::pmr::unordered_set<Name>(&arena).swap(names);
+        std::pmr::vector<Entry>(&arena).swap(entries);
+        arena.release();
+    }
+
+    std::mutex mutex;
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::vector<Entry> entries;
+    std::pmr::unordered_set<Name> names;
+};
+
+// Lock and manifest of a persistent temporary directory opened by open_or_create.
+struct TempDir::Persistence
+{
+    fs::path manifest;
+    std::vector<std::string> artifacts;
+    std::set<std::string, std::less<>> completed;
+    bool resumed = false;
+    mutable std::mutex mutex;
+#ifdef TD_POSIX
+    detail::FileDescriptor fd;
+#endif
+};
+
+// state of a migratable TempDir, shared with the registry used by MemoryPressureWatcher
+struct TempDir::Migration
+{
+    fs::path link; // path of the TempDir, a symlink to data
+    fs::path data; // current location of the contents
+    fs::path disk_root;
+    std::mutex mutex;
+    std::condition_variable idle;
+    std::size_t writers = 0;  // write_files or materialize in progress
+    std::uint64_t writes = 0; // started writes, detects writes during a copy
+    bool quiescent = false;   // declared by the user, see TempDir::set_quiescent
+    bool migrating = false;
+    bool migrated = false;
+    bool removed = false;
+
+    // Marks a write in progress, a migration is not completed meanwhile.
+    class Writer
+    {
+      public:
+        explicit Writer(Migration* migration) : _migration(migration)
+        {
+            if (!_migration)
+                return;
+            std::lock_guard<std::mutex> lock(_migration->mutex);
+            ++_migration->writers;
+            ++_migration->writes;
+        }
+
+        ~Writer()
+        {
+            if (!_migration)
+                return;
+            std::lock_guard<std::mutex> lock(_migration->mutex);
+            --_migration->writers;
+        }
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+      private:
+        Migration* _migration;
+    };
+
+    // Copies the contents to the disk root and swaps the symlink, see TempDir::migrate.
+    bool migrate()
+    {
+        std::uint64_t started_writes = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!quiescent || migrated || removed || migrating || writers > 0)
+                return false;
+            migrating = true;
+            started_writes = writes;
+        }
+
+        // only entries created by this call are removed on failure, an existing target or
+        // partial copy is never touched
+        fs::path target = disk_root / data.filename();
+        fs::path partial = target;
+        partial += ".partial";
+        fs::path old;
+        bool created_partial = false;
+        bool created_target = false;
+        bool renamed = false;
+        try
+        {
+            fs::create_directories(disk_root);
+            created_partial = fs::create_directory(partial);
+            created_target = created_partial && fs::create_directory(target);
+            if (created_target)
+            {
+                auto state = detail::tree_state(data);
+                fs::copy(data, partial,
+                         fs::copy_options::recursive | fs::copy_options::copy_symlinks);
+                // replaces the empty target created above
+                fs::rename(partial, target);
+                renamed = true;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!removed && writers == 0 && writes == started_writes)
+                {
+                    // rename replaces the symlink atomically, path() never dangles
+                    swap_link(target);
+                    // writes bypassing write_files and materialize despite the quiescence
+                    // declaration would be lost with the old contents
+                    if (detail::tree_state(data) == state)
+                    {
+                        old = data;
+                        data = target;
+                        migrated = true;
+                    }
+                    else
+                        swap_link(data);
+                }
+            }
+        }
+        catch (const std::exception&)
+        {
+            // the contents stay where they are
+        }
+
+        std::error_code ec;
+        if (!old.empty())
+            fs::remove_all(old, ec);
+        else if (renamed)
+            fs::remove_all(target, ec);
+        else if (created_target)
+            fs::remove(target, ec); // only if still empty
+        if (created_partial && !renamed)
+            fs::remove_all(partial, ec);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        migrating = false;
+        idle.notify_all();
+        return !old.empty();
+    }
+
+    // Points the symlink at path() to the given contents, replacing it atomically.
+    void swap_link(const fs::path& contents)
+    {
+        fs::path next = link;
+        next += ".next";
+        fs::create_directory_symlink(contents, next);
+        fs::rename(next, link);
+    }
+
+    // Removes the contents and the symlink, waits for a running migration.
+    std::uintmax_t remove()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        removed = true;
+        idle.wait(lock, [this] { return !migrating; });
+        fs::path contents = data;
+        lock.unlock();
+        return detail::remove_tree(contents) + detail::remove_tree(link);
+    }
+
+    static void add(const std::shared_ptr<Migration>& migration)
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        auto& migrations = registry();
+        migrations.erase(std::remove_if(migrations.begin(), migrations.end(),
+                                        [](const auto& entry) { return entry.expired(); }),
+                         migrations.end());
+        migrations.push_back(migration);
+    }
+
+    // Migrates all migratable TempDirs of the process, returns the number of migrated ones.
+    static std::size_t migrate_all()
+    {
+        std::vector<std::shared_ptr<Migration>> migrations;
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            for (const auto& entry : registry())
+                if (auto migration = entry.lock())
+                    migrations.push_back(std::move(migration));
+        }
+
+        std::size_t migrated = 0;
+        for (const auto& migration : migrations)
+            migrated += migration->migrate() ? 1 : 0;
+        return migrated;
+    }
+
+  private:
+    static std::mutex& registry_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::vector<std::weak_ptr<Migration>>& registry()
+    {
+        static std::vector<std::weak_ptr<Migration>> migrations;
+        return migrations;
+    }
+};
+
+TD_INLINE TempDir::TempDir(Config config) : TempDir(std::move(config), CallSite{}) {}
+
+TD_INLINE TempDir TempDir::create(Config config, CallSite call_site)
+{
+    return TempDir(std::move(config), call_site);
+}
+
+TD_INLINE TempDir::TempDir(Config config, CallSite call_site)
+    : _config(config), _call_site(call_site),
+      _trace_id(config.trace_recorder ? config.trace_recorder->next_dir_id() : 0)
+{
+    try
+    {
+        detail::TraceScope trace(_config.trace_recorder, _trace_id, TraceOp::create);
+        detail::PhaseTimer timer(_config.slow_operation_threshold_us > 0);
+        SlowOperation operation;
+        operation.operation = "create";
+
+        if (_config.avoid_container_layer)
+        {
+            _config.root_path = select_root(_config);
+            if (_config.root_path != config.root_path)
+                log("TempDir root '", config.root_path, "' is on a container layer, using '",
+                    _config.root_path, "'");
+        }
+
+        fs::path parent = _config.root_path;
+        if (detail::in_session(_config))
+            parent = detail::SessionRegistry::instance().session_path(_config);
+        else if (detail::in_generation(_config))
+            parent = detail::GenerationRegistry::instance().generation_path(_config);
+        _temp_dir = parent / generate_dir_name();
+        operation.name_generation_us = timer.lap();
+        fs::path created = _temp_dir;
+        if (!_config.migration_root.empty())
+            created += ".d";
+        if (detail::in_generation(_config))
+            detail::GenerationRegistry::instance().create_in_generation(created);
+        else
+            fs::create_directories(created);
+
+        if (!_config.migration_root.empty())
+        {
+            _migration = std::make_shared<Migration>();
+            _migration->link = _temp_dir;
+            _migration->data = created;
+            _migration->disk_root = _config.migration_root;
+            fs::create_directory_symlink(_migration->data.filename(), _temp_dir);
+            Migration::add(_migration);
+        }
+        operation.mkdir_us = timer.lap();
+        log("TempDir create '", _temp_dir, "'");
+
+        operation.total_us = operation.name_generation_us + operation.mkdir_us;
+        report_if_slow(operation);
+        trace.finish();
+    }
+    catch (const std::exception& ex)
+    {
+        log("TempDir creation of '", _temp_dir, "' failed. Error: ", ex.what());
+        throw TempDirException(ex);
+    }
+}
+
+TD_INLINE TempDir::TempDir(Config config, fs::path path,
+                           std::unique_ptr<Persistence> persistence, CallSite call_site)
+    : _temp_dir(std::move(path)), _config(config), _persistence(std::move(persistence)),
+      _call_site(call_site),
+      _trace_id(config.trace_recorder ? config.trace_recorder->next_dir_id() : 0)
+{
+    // opening or attaching an existing directory is replayed as creation
+    detail::TraceScope(_config.trace_recorder, _trace_id, TraceOp::create).finish();
+}
+
+TD_INLINE TempDir TempDir::open_or_create(std::string_view key, Config config,
+                                          CallSite call_site)
+{
+    if (config.avoid_container_layer)
+        config.root_path = select_root(config);
+    std::string name = config.temp_dir_prefix + "_" + detail::sanitize_name(key, 128);
+    fs::path path = config.root_path / name;
+    auto persistence = std::make_unique<Persistence>();
+    persistence->manifest = config.root_path / (name + ".manifest");
+
+    try
+    {
+        fs::create_directories(config.root_path);
+#ifdef TD_POSIX
+        persistence->fd = detail::FileDescriptor(::open(
+            persistence->manifest.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666));
+        if (!persistence->fd)
+            detail::throw_errno("open", persistence->manifest);
+        if (::flock(persistence->fd.get(), LOCK_EX | LOCK_NB) != 0)
+        {
+            if (errno == EWOULDBLOCK)
+                throw std::runtime_error("'" + path.string() + "' is owned by another TempDir");
+            detail::throw_errno("flock", persistence->manifest);
+        }
+#endif
+        persistence->resumed = fs::is_directory(path);
+        fs::create_directories(path);
+
+        // a line without line break is the torn record of a crash and is ignored
+        std::ifstream in(persistence->manifest, std::ios::binary);
+        std::string line;
+        while (std::getline(in, line) && !in.eof())
+        {
+            if (persistence->completed.insert(line).second)
+                persistence->artifacts.push_back(line);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        if (config.log_impl)
+            config.log_impl("TempDir open of '" + path.string() + "' failed. Error: " + ex.what());
+        throw TempDirException(ex);
+    }
+
+    TempDir temp_dir(config, path, std::move(persistence), call_site);
+    temp_dir.log("TempDir ", temp_dir.resumed() ? "resume '" : "create '", path, "'");
+    return temp_dir;
+}
+
+TD_INLINE bool TempDir::resumed() const { return _persistence && _persistence->resumed; }
+
+TD_INLINE void TempDir::mark_completed(std::string_view artifact)
+{
+    if (!_persistence)
+        throw TempDirException(std::logic_error("TempDir was not opened by open_or_create"));
+    if (artifact.find('\n') != std::string_view::npos)
+        throw TempDirException(std::invalid_argument("artifact name contains a line break"));
+
+    std::lock_guard<std::mutex> lock(_persistence->mutex);
+    if (_persistence->completed.find(artifact) != _persistence->completed.end())
+        return;
+
+    std::string line(artifact);
+    line.push_back('\n');
+    try
+    {
+#ifdef TD_POSIX
+        // a single append keeps the record intact, it is durable once fsync returns
+        if (::write(_persistence->fd.get(), line.data(), line.size()) !=
+            static_cast<ssize_t>(line.size()))
+            detail::throw_errno("write", _persistence->manifest);
+        if (::fsync(_persistence->fd.get()) != 0)
+            detail::throw_errno("fsync", _persistence->manifest);
+#else
+        std::ofstream out(_persistence->manifest, std::ios::binary | std::ios::app);
+        out.write(line.data(), line.size());
+        out.flush();
+        if (!out)
+            throw fs::filesystem_error("write failed", _persistence->manifest,
+                                       std::make_error_code(std::errc::io_error));
+#endif
+    }
+    catch (const std::exception& ex)
+    {
+        log("TempDir mark completed failed. Error: ", ex.what());
+        throw TempDirException(ex);
+    }
+
+    line.pop_back();
+    _persistence->completed.insert(line);
+    _persistence->artifacts.push_back(std::move(line));
+}
+
+TD_INLINE bool TempDir::completed(std::string_view artifact) const
+{
+    if (!_persistence)
+        return false;
+    std::lock_guard<std::mutex> lock(_persistence->mutex);
+    return _persistence->completed.find(artifact) != _persistence->completed.end();
+}
+
+TD_INLINE std::vector<std::string> TempDir::completed_artifacts() const
+{
+    if (!_persistence)
+        return {};
+    std::lock_guard<std::mutex> lock(_persistence->mutex);
+    return _persistence->artifacts;
+}
+
+TD_INLINE TempDir::TempDir(TempDir&&) noexcept = default;
+TD_INLINE TempDir& TempDir::operator=(TempDir&&) noexcept = default;
+
+TD_INLINE TempDir::~TempDir()
+{
+    try
+    {
+        cleanup();
+    }
+    catch (const std::exception& e)
+    {
+        // do nothing as rethrowing is not allowed in destructor
+        // error was already logged in cleanup method
+    }
+}
+
+TD_INLINE PrefetchResult TempDir::prefetch(const std::vector<fs::path>& paths,
+                                           PrefetchOptions options) const
+{
+    detail::TraceScope trace(_config.trace_recorder, _trace_id, TraceOp::prefetch);
+    std::vector<fs::path> files;
+    try
+    {
+        for (const auto& path : paths.empty() ? std::vector<fs::path>{_temp_dir} : paths)
+        {
+            auto found = detail::regular_files(path.is_absolute() ? path : _temp_dir / path);
+            files.insert(files.end(), found.begin(), found.end());
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        log("TempDir prefetch failed. Error: ", ex.what());
+        throw TempDirException(ex);
+    }
+
+    std::atomic<std::uintmax_t> total{0}, before{0}, after{0};
+    detail::parallel_for(files.size(), options.threads, [&](std::size_t i) {
+        detail::prefetch_file(files[i], options.wait, total, before, after);
+    });
+
+    PrefetchResult result;
+    result.files = files.size();
+    result.total_bytes = total;
+    result.resident_bytes_before = before;
+    result.resident_bytes_after = after;
+    trace.finish(result.files, result.total_bytes);
+    return result;
+}
+
+TD_INLINE void TempDir::cleanup()
+{
+    if (!fs::exists(_temp_dir))
+        return;
+
+    if (!detail::cleanup_allowed(_config.cleanup))
+    {
+        if (detail::in_session(_config))
+            detail::SessionRegistry::instance().keep(_temp_dir.parent_path());
+        log("TempDir keep '", _temp_dir, "'");
+        return;
+    }
+
+    try
+    {
+        detail::TraceScope trace(_config.trace_recorder, _trace_id, TraceOp::cleanup);
+        detail::PhaseTimer timer(_config.slow_operation_threshold_us > 0);
+        SlowOperation operation;
+        operation.operation = "cleanup";
+        CleanupStrategy strategy = _config.cleanup_strategy;
+        if (strategy == CleanupStrategy::adaptive && !_migration)
+            strategy = choose_cleanup_strategy();
+
+        detail::RemovalBudget budget(_config.cleanup_budget_us, _config.cleanup_budget_entries);
+        bool budgeted = _config.cleanup_budget_us > 0 || _config.cleanup_budget_entries > 0;
+        if (_migration)
+            operation.entries = _migration->remove();
+        else if (strategy == CleanupStrategy::deferred)
+            operation.entries = remove_in_background();
+        else if (strategy == CleanupStrategy::parallel)
+            operation.entries = remove_journaled(nullptr, 0);
+        else
+            operation.entries = remove_journaled(budgeted ? &budget : nullptr);
+        if (budget.exhausted)
+            operation.entries += remove_in_background();
+        operation.removal_us = operation.total_us = timer.lap();
+        report_if_slow(operation);
+        trace.finish(operation.entries);
+
+        if (_persistence)
+        {
+            // the manifest is removed while the lock is still held
+            fs::remove(_persistence->manifest);
+            _persistence.reset();
+        }
+        if (detail::in_generation(_config))
+            detail::GenerationRegistry::instance().released(_temp_dir.parent_path());
+        log("TempDir remove '", _temp_dir, "'");
+    }
+    catch (const std::exception& ex)
+    {
+        log("TempDir removal of '", _temp_dir, "' failed. Error: ", ex.what());
+        throw TempDirException(ex);
+    }
+}
+
+TD_INLINE CacheFootprint TempDir::cache_footprint(FootprintOptions options) const
+{
+    detail::TraceScope trace(_config.trace_recorder, _trace_id, TraceOp::cache_footprint);
+    std::vector<fs::path> files;
+    try
+    {
+        files = detail::regular_files(_temp_dir);
+    }
+    catch (const std::exception& ex)
+    {
+        log("TempDir cache footprint failed. Error: ", ex.what());
+        throw TempDirException(ex);
+    }
+
+    std::size_t stride = 1;
+    if (options.max_files > 0 && files.size() > options.max_files)
+        stride = (files.size() + options.max_files - 1) / options.max_files;
+    std::size_t inspected = (files.size() + stride - 1) / stride;
+
+    std::atomic<std::uintmax_t> total{0}, resident{0}, dirty{0}, writeback{0};
+    detail::parallel_for(inspected, options.threads, [&](std::size_t i) {
+        const fs::path& file = files[i * stride];
+#ifdef TD_POSIX
+        detail::FileDescriptor fd(::open(file.c_str(), O_RDONLY | O_CLOEXEC));
+        struct stat st;
+        if (!fd || ::fstat(fd.get(), &st) != 0)
+            return;
+
+        std::uintmax_t size = static_cast<std::uintmax_t>(st.st_size);
+        detail::PageCacheState state = detail::page_cache_state(fd.get(), size);
+        total += size;
+        resident += state.resident;
+        dirty += state.dirty;
+        writeback += state.writeback;
+#else
+        std::error_code ec;
+        std::uintmax_t size = fs::file_size(file, ec);
+        if (!ec)
+            total += size;
+#endif
+    });
+
+    auto extrapolate = [&](std::uintmax_t value) {
+        return inspected == 0 ? value : value * files.size() / inspected;
+    };
+
+    CacheFootprint footprint;
+    footprint.files = files.size();
+    footprint.inspected_files = inspected;
+    footprint.estimated = inspected < files.size();
+    footprint.total_bytes = extrapolate(total);
+    footprint.resident_bytes = extrapolate(resident);
+    footprint.dirty_bytes = extrapolate(dirty);
+    footprint.writeback_bytes = extrapolate(writeback);
+    trace.finish(footprint.inspected_files, footprint.total_bytes);
+    return footprint;
+}
+
+TD_INLINE void TempDir::write_files(const std::vector<FileSpec>& files, WriteOptions options) const
+{
+    detail::TraceScope trace(_config.trace_recorder, _trace_id, TraceOp::write_files);
+    write_files_impl(files, options);
+
+    std::uint64_t bytes = 0;
+    for (const auto& file : files)
+        bytes += file.content.size();
+    trace.finish(files.size(), bytes);
+}
+
+TD_INLINE void TempDir::write_files_impl(const std::vector<FileSpec>& files,
+                                         WriteOptions options) const
+{
+    Migration::Writer writer(_migration.get());
+    try
+    {
+        std::pmr::set<fs::path> directories(_config.memory_resource);
+        for (const auto& file : files)
+        {
+            detail::validate_relative_path(file.path);
+            detail::add_parent_directories(directories, file.path);
+        }
+        Journal& journal = this->journal();
+        detail::create_directories(_temp_dir, directories, [&journal](const fs::path& dir) {
+            journal.record(dir, true);
+        });
+        for (const auto& file : files)
+            journal.record(file.path, false);
+
+#ifdef TD_POSIX
+        detail::FileDescriptor dir_fd(
+            ::open(_temp_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (!dir_fd)
+            detail::throw_errno("open", _temp_dir);
+
+        detail::parallel_for(files.size(), options.threads, [&](std::size_t i) {
+            detail::write_file_at(dir_fd.get(), _temp_dir, files[i]);
+        });
+#else
+        detail::parallel_for(files.size(), options.threads, [&](std::size_t i) {
+            std::ofstream out(_temp_dir / files[i].path, std::ios::binary | std::ios::trunc);
+            out.write(files[i].content.data(), files[i].content.size());
+            if (!out)
+                throw fs::filesystem_error("write failed", _temp_dir / files[i].path,
+                                           std::make_error_code(std::errc::io_error));
+        });
+#endif
+    }
+    catch (const std::exception& ex)
+    {
+        log("TempDir write files failed. Error: ", ex.what());
+        throw TempDirException(ex);
+    }
+}
+
+TD_INLINE void TempDir::materialize(const Fixture& fixture, MaterializeOptions options) const
+{
+    detail::TraceScope trace(_config.trace_recorder, _trace_id, TraceOp::materialize);
+    Migration::Writer writer(_migration.get());
+    const auto& nodes = fixture.nodes();
+    std::pmr::vector<std::size_t> file_nodes(_config.memory_resource);
+    std::pmr::set<fs::path> directories(_config.memory_resource);
+
+    try
+    {
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+        {
+            detail::validate_relative_path(nodes[i].path);
+            detail::add_parent_directories(directories, nodes[i].path);
+            if (nodes[i].is_directory)
+                directories.insert(nodes[i].path);
+            else
+                file_nodes.push_back(i);
+        }
+        Journal& journal = this->journal();
+        detail::create_directories(_temp_dir, directories, [&journal](const fs::path& dir) {
+            journal.record(dir, true);
+        });
+
+        detail::SynchronizedResource shared_resource(_config.memory_resource);
+        std::pmr::vector<std::pmr::string> contents(file_nodes.size(), &shared_resource);
+        detail::parallel_for(file_nodes.size(), options.threads, [&](std::size_t i) {
+            contents[i] = nodes[file_nodes[i]].resolve_content();
+        });
+
+        // maps each file to the index of the first file with identical content
+        std::pmr::vector<std::size_t> origin(file_nodes.size(), _config.memory_resource);
+        std::pmr::unordered_map<std::string_view, std::size_t> first_by_content(
+            _config.memory_resource);
+        std::vector<FileSpec> files;
+        for (std::size_t i = 0; i < file_nodes.size(); ++i)
+        {
+            origin[i] = i;
+            if (options.deduplicate)
+                origin[i] = first_by_content.emplace(contents[i], i).first->second;
+            if (origin[i] == i)
+                files.push_back({nodes[file_nodes[i]].path, contents[i]});
+        }
+        write_files_impl(files, WriteOptions().set_threads(options.threads));
+        for (std::size_t i = 0; i < file_nodes.size(); ++i)
+        {
+            if (origin[i] != i)
+                journal.record(nodes[file_nodes[i]].path, false);
+        }
+
+        detail::parallel_for(file_nodes.size(), options.threads, [&](std::size_t i) {
+            if (origin[i] == i)
+                return;
+
+            fs::path target = _temp_dir / nodes[file_nodes[i]].path;
+            fs::path source = _temp_dir / nodes[file_nodes[origin[i]]].path;
+            std::error_code ec;
+            fs::remove(target, ec);
+            fs::create_hard_link(source, target, ec);
+            if (ec)
+                fs::copy_file(source, target, fs::copy_options::overwrite_existing);
+        });
+
+        std::uint64_t bytes = 0;
+        for (const auto& content : contents)
+            bytes += content.size();
+        trace.finish(nodes.size(), bytes);
+    }
+    catch (const TempDirException&)
+    {
+        throw;
+    }
+    catch (const std::exception& ex)
+    {
+        log("TempDir materialize failed. Error: ", ex.what());
+        throw TempDirException(ex);
+    }
+}
+
+TD_INLINE std::vector<std::string> TempDir::verify(const Fixture& fixture,
+                                                   VerifyOptions options) const
+{
+    detail::TraceScope trace(_config.trace_recorder, _trace_id, TraceOp::verify);
+    const auto& nodes = fixture.nodes();
+    std::vector<std::string> differences(nodes.size());
+    std::vector<std::string> result;
+
+    try
+    {
+        detail::parallel_for(nodes.size(), options.threads, [&](std::size_t i) {
+            const Fixture::Node& node = nodes[i];
+            fs::path path = _temp_dir / node.path;
+            std::error_code ec;
+
+            if (node.is_directory)
+            {
+                if (!fs::is_directory(path, ec))
+                    differences[i] = "missing directory '" + node.path.generic_string() + "'";
+                return;
+            }
+
+            if (!fs::is_regular_file(path, ec))
+            {
+                differences[i] = "missing file '" + node.path.generic_string() + "'";
+                return;
+            }
+
+            std::ifstream in(path, std::ios::binary);
+            std::string actual((std::istreambuf_iterator<char>(in)),
+                               std::istreambuf_iterator<char>());
+            if (actual != node.resolve_content())
+                differences[i] = "content of file '" + node.path.generic_string() + "' differs";
+        });
+
+        for (auto& difference : differences)
+        {
+            if (!difference.empty())
+                result.push_back(std::move(difference));
+        }
+
+        if (options.exact)
+        {
+            std::pmr::set<fs::path> described(_config.memory_resource);
+            for (const auto& node : nodes)
+            {
+                described.insert(node.path.lexically_normal());
+                detail::add_parent_directories(described, node.path.lexically_normal());
+            }
+
+            std::error_code ec;
+            fs::recursive_directory_iterator it(_temp_dir, ec);
+            for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+            {
+                fs::path relative = it->path().lexically_relative(_temp_dir);
+                if (described.count(relative) == 0)
+                    result.push_back("unexpected entry '" + relative.generic_string() + "'");
+            }
+            if (ec)
+                throw fs::filesystem_error("list", _temp_dir, ec);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        log("TempDir verify failed. Error: ", ex.what());
+        throw TempDirException(ex);
+    }
+
+    trace.finish(nodes.size(), result.size());
+    return result;
+}
+
+TD_INLINE Listing TempDir::list(ListOptions options) const
+{
+    detail::TraceScope trace(_config.trace_recorder, _trace_id, TraceOp::list);
+    try
+    {
+        Listing listing(_config.memory_resource);
+        std::pmr::vector<std::pmr::string> level(_config.memory_resource);
+        detail::read_directory(_temp_dir, {}, listing, level);
+
+        detail::SynchronizedResource shared_resource(_config.memory_resource);
+        while (options.recursive && !level.empty())
+        {
+            std::pmr::vector<Listing> listings(&shared_resource);
+            listings.reserve(level.size());
+            for (std::size_t i = 0; i < level.size(); ++i)
+                listings.emplace_back(&shared_resource);
+            std::pmr::vector<std::pmr::vector<std::pmr::string>> subdirectories(
+                level.size(), &shared_resource);
+            detail::parallel_for(level.size(), options.threads, [&](std::size_t i) {
+                std::pmr::string prefix(level[i], &shared_resource);
+                prefix.push_back('/');
+                detail::read_directory(_temp_dir / level[i], prefix, listings[i],
+                                       subdirectories[i]);
+            });
+
+            level.clear();
+            for (std::size_t i = 0; i < listings.size(); ++i)
+            {
+                listing.append(listings[i]);
+                level.insert(level.end(), subdirectories[i].begin(), subdirectories[i].end());
+            }
+        }
+
+        listing.sort();
+        trace.finish(listing.size());
+        return listing;
+    }
+    catch (const std::exception& ex)
+    {
+        log("TempDir list failed. Error: ", ex.what());
+        throw TempDirException(ex);
+    }
+}
+
+TD_INLINE std::pmr::string TempDir::generate_dir_name() const
+{
+    using namespace std::chrono;
+
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<> dist(10000, 99999);
+    int random_number = dist(gen);
+
+    auto now = system_clock::now();
+    auto timestamp = duration_cast<milliseconds>(now.time_since_epoch()).count();
+
+    std::pmr::string name(_config.temp_dir_prefix, _config.memory_resource);
+    name.append("_").append(std::to_string(timestamp));
+    name.append("_").append(std::to_string(random_number));
+    return name;
+}
+
+TD_INLINE TempDir::Journal& TempDir::journal() const
+{
+    // TempDirs the library never writes to do not pay for the journal and its arena
+    return _journal.get_or_create(_config.memory_resource);
+}
+
+TD_INLINE std::uintmax_t TempDir::remove_journaled(detail::RemovalBudget* budget,
+                                                   std::size_t threads)
+{
+    std::uintmax_t removed = 0;
+    if (_journal)
+    {
+        std::lock_guard<std::mutex> lock(_journal->mutex);
+        auto& entries = _journal->entries;
+        if (!entries.empty())
+        {
+#ifdef TD_POSIX
+            detail::FileDescriptor dir_fd(
+                ::open(_temp_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+            if (!dir_fd)
+                detail::throw_errno("open", _temp_dir);
+
+            // entries below a parent that was replaced by a symlink or another type of entry
+            // are skipped, they are left to the scan below
+            auto unlink = [](detail::ParentDirectories& parents, const Journal::Entry& entry) {
+                std::string_view leaf;
+                int parent_fd = parents.open(entry.name, leaf);
+                int flags = entry.is_directory ? AT_REMOVEDIR : 0;
+                return parent_fd >= 0 && ::unlinkat(parent_fd, leaf.data(), flags) == 0;
+            };
+
+            if (threads != 1)
+            {
+                // files first in parallel, the directories remain for the loop below
+                constexpr std::size_t chunk = 256;
+                std::atomic<std::uintmax_t> unlinked{0};
+                std::size_t chunks = (entries.size() + chunk - 1) / chunk;
+                detail::parallel_for(chunks, threads, [&](std::size_t c) {
+                    detail::ParentDirectories parents(dir_fd.get());
+                    std::size_t end = std::min(entries.size(), (c + 1) * chunk);
+                    for (std::size_t i = c * chunk; i < end; ++i)
+                    {
+                        if (!entries[i].is_directory && unlink(parents, entries[i]))
+                            ++unlinked;
+                    }
+                });
+                removed += unlinked;
+            }
+
+            detail::ParentDirectories parents(dir_fd.get());
+            for (auto entry = entries.rbegin(); entry != entries.rend(); ++entry)
+            {
+                if (budget && !budget->spend())
+                    break;
+                if (threads != 1 && !entry->is_directory)
+                    continue;
+
+                // entries that are not empty, not writable or replaced by another type of entry
+                // are left to the scan below, which repairs permissions in the same walk
+                if (unlink(parents, *entry))
+                    ++removed;
+            }
+#else
+            // entries below a parent that was replaced by a symlink are left to the scan below
+            auto parents_are_directories = [this](const fs::path& relative) {
+                fs::path parent = _temp_dir;
+                std::error_code ec;
+                for (auto it = relative.begin(); std::next(it) != relative.end(); ++it)
+                {
+                    parent /= *it;
+                    if (fs::symlink_status(parent, ec).type() != fs::file_type::directory)
+                        return false;
+                }
+                return true;
+            };
+
+            for (auto entry = entries.rbegin(); entry != entries.rend(); ++entry)
+            {
+                if (budget && !budget->spend())
+                    break;
+                if (!parents_are_directories(entry->name))
+                    continue;
+
+                std::error_code ec;
+                if (fs::remove(_temp_dir / entry->name, ec))
+                    ++removed;
+                else if (ec)
+                    removed += fs::remove_all(_temp_dir / entry->name);
+            }
+#endif
+        }
+
+        _journal->clear();
+    }
+    if (budget && budget->exhausted)
+        return removed;
+
+#ifdef TD_POSIX
+    if (::rmdir(_temp_dir.c_str()) == 0)
+        return removed + 1;
+    if (errno == ENOENT)
+        return removed;
+    if (errno != ENOTEMPTY && errno != EEXIST)
+        detail::throw_errno("rmdir", _temp_dir);
+#endif
+    // entries not created by the library remain, they are found by a directory scan
+    if (threads != 1)
+        removed += detail::remove_contents(_temp_dir, threads);
+    return removed + detail::remove_tree(_temp_dir, budget);
+}
+
+TD_INLINE bool TempDir::migrate()
+{
+    if (!_migration || !_migration->migrate())
+        return false;
+    log("TempDir migrate '", _temp_dir, "' to '", _config.migration_root, "'");
+    return true;
+}
+
+TD_INLINE void TempDir::set_quiescent(bool quiescent)
+{
+    if (!_migration)
+        return;
+    std::lock_guard<std::mutex> lock(_migration->mutex);
+    _migration->quiescent = quiescent;
+}
+
+TD_INLINE bool TempDir::migrated() const
+{
+    if (!_migration)
+        return false;
+    std::lock_guard<std::mutex> lock(_migration->mutex);
+    return _migration->migrated;
+}
+
+TD_INLINE CleanupStrategy TempDir::choose_cleanup_strategy() const
+{
+    std::size_t journaled = 0;
+    if (_journal)
+    {
+        std::lock_guard<std::mutex> lock(_journal->mutex);
+        journaled = _journal->entries.size();
+    }
+    double entries = std::max(double(journaled), detail::estimate_tree_size(_temp_dir));
+
+    std::uint64_t threshold_us = _config.cleanup_budget_us > 0
+                                     ? _config.cleanup_budget_us
+                                     : detail::adaptive_defer_threshold_us;
+    CleanupStrategy strategy = detail::CleanupCostModels::instance()
+                                   .model(_temp_dir)
+                                   .choose(entries, double(threshold_us) * 1000.0);
+
+    static constexpr const char* names[] = {"serial", "parallel", "deferred"};
+    log("TempDir cleanup of '", _temp_dir, "' estimated ",
+        std::to_string(static_cast<std::uintmax_t>(entries)), " entries, strategy ",
+        names[static_cast<int>(strategy)]);
+    return strategy;
+}
+
+TD_INLINE std::uintmax_t TempDir::remove_in_background()
+{
+    fs::path removing = _temp_dir;
+    removing += ".removing";
+    std::error_code ec;
+    fs::rename(_temp_dir, removing, ec);
+    if (ec)
+        return detail::remove_tree(_temp_dir);
+
+    fs::path generation = detail::in_generation(_config) ? _temp_dir.parent_path() : fs::path();
+    detail::BackgroundRemover::instance().remove(removing, generation);
+    log("TempDir remove '", _temp_dir, "' in background");
+    return 0;
+}
+
+TD_INLINE void TempDir::report_if_slow(SlowOperation& operation) const
+{
+    if (_config.slow_operation_threshold_us == 0 ||
+        operation.total_us < _config.slow_operation_threshold_us)
+        return;
+
+    operation.call_site = _call_site;
+    operation.path = _temp_dir;
+    if (_config.slow_operation_handler)
+    {
+        _config.slow_operation_handler(operation);
+        return;
+    }
+
+    std::string message =
+        std::string("TempDir slow ") + operation.operation + " of '" + _temp_dir.string() + "'";
+    if (_call_site.line > 0)
+        message += std::string(" created at ") + _call_site.file + ":" +
+                   std::to_string(_call_site.line);
+    message += " took " + std::to_string(operation.total_us) + "us";
+    if (std::string_view(operation.operation) == "cleanup")
+        message += " (removal " + std::to_string(operation.removal_us) + "us, " +
+                   std::to_string(operation.entries) + " entries)";
+    else
+        message += " (name generation " + std::to_string(operation.name_generation_us) +
+                   "us, mkdir " + std::to_string(operation.mkdir_us) + "us)";
+    _config.log_impl ? _config.log_impl(message) : bw::tempdir::log(message);
+}
+
+TD_INLINE RootInfo TempDir::inspect_root(const fs::path& path, const fs::path& mountinfo)
+{
+    return detail::RootInfoCache::instance().get(path, mountinfo);
+}
+
+TD_INLINE fs::path TempDir::select_root(const Config& config)
+{
+    if (!config.avoid_container_layer || !inspect_root(config.root_path).container_layer)
+        return config.root_path;
+
+    for (const auto& volume : config.volume_roots)
+        if (detail::writable_directory(volume) && !inspect_root(volume).container_layer)
+            return volume;
+
+    fs::path shm = "/dev/shm";
+    if (detail::writable_directory(shm) && inspect_root(shm).filesystem == "tmpfs")
+        return shm;
+    return config.root_path;
+}
+
+TD_INLINE std::size_t TempDir::reap_sessions(const Config& config)
+{
+    std::string marker = config.temp_dir_prefix + "_session_";
+    std::vector<fs::path> stale;
+    try
+    {
+        for (const auto& entry : fs::directory_iterator(config.root_path))
+        {
+            std::string name = entry.path().filename().string();
+            if (name.compare(0, marker.size(), marker) != 0 || !entry.is_directory())
+                continue;
+
+            // <prefix>_session_<pid>_<start>_<pid namespace>[.removing]
+            const char* field = name.c_str() + marker.size();
+            char* end = nullptr;
+            long pid = std::strtol(field, &end, 10);
+            unsigned long long start = *end == '_' ? std::strtoull(end + 1, &end, 10) : 0;
+            unsigned long long pid_ns = *end == '_' ? std::strtoull(end + 1, &end, 10) : 0;
+            if ((*end != '\0' && std::string_view(end) != ".removing") ||
+                !detail::process_exited(pid, start, pid_ns))
+                continue;
+            if (fs::exists(entry.path() / detail::session_keep_marker))
+                continue;
+            stale.push_back(entry.path());
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        throw TempDirException(ex);
+    }
+
+    std::size_t reaped = 0;
+    for (const fs::path& session : stale)
+    {
+        try
+        {
+            detail::remove_session(session);
+            ++reaped;
+        }
+        catch (const std::exception&)
+        {
+            // the session is reaped concurrently by another process or not accessible
+        }
+    }
+    return reaped;
+}
+
+namespace detail
+{
+// Returns the path of the reference count file of a cross-process SharedTempDir.
+inline fs::path refs_path(const fs::path& path)
+{
+    fs::path refs = path;
+    refs += ".refs";
+    return refs;
+}
+
+#ifdef TD_POSIX
+// Reads the reference count stored in fd, the caller holds the lock of the file.
+inline long read_refs(int fd, const fs::path& refs)
+{
+    char buffer[32] = {};
+    ssize_t size = ::pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (size < 0)
+        throw_errno("read", refs);
+    return std::strtol(buffer, nullptr, 10);
+}
+
+// Writes the reference count to fd, the caller holds the lock of the file.
+inline void write_refs(int fd, const fs::path& refs, long count)
+{
+    std::string content = std::to_string(count);
+    if (::ftruncate(fd, 0) != 0)
+        throw_errno("truncate", refs);
+    if (::pwrite(fd, content.data(), content.size(), 0) != static_cast<ssize_t>(content.size()))
+        throw_errno("write", refs);
+}
+
+// Opens and exclusively locks the reference count file.
+inline FileDescriptor lock_refs(const fs::path& refs, int flags)
+{
+    FileDescriptor fd(::open(refs.c_str(), O_RDWR | O_CLOEXEC | flags, 0666));
+    if (!fd)
+        throw_errno("open", refs);
+    while (::flock(fd.get(), LOCK_EX) != 0)
+    {
+        if (errno != EINTR)
+            throw_errno("flock", refs);
+    }
+    return fd;
+}
+#endif
+} // namespace detail
+
+TD_INLINE SharedTempDir::SharedTempDir(Config config)
+    : _temp_dir(std::make_shared<TempDir>(std::move(config)))
+{
+}
+
+TD_INLINE SharedTempDir SharedTempDir::create_cross_process(Config config, CallSite call_site)
+{
+#ifdef TD_POSIX
+    std::unique_ptr<TempDir> temp_dir(new TempDir(config, call_site));
+    try
+    {
+        fs::path refs = detail::refs_path(temp_dir->path());
+        detail::FileDescriptor fd = detail::lock_refs(refs, O_CREAT | O_EXCL);
+        detail::write_refs(fd.get(), refs, 1);
+    }
+    catch (const std::exception& ex)
+    {
+        temp_dir->log("SharedTempDir creation failed. Error: ", ex.what());
+        throw TempDirException(ex);
+    }
+    return SharedTempDir(share_cross_process(std::move(temp_dir)));
+#else
+    (void)config;
+    (void)call_site;
+    throw TempDirException(std::runtime_error("SharedTempDir across processes requires POSIX"));
+#endif
+}
+
+TD_INLINE SharedTempDir SharedTempDir::attach(const fs::path& path, Config config,
+                                              CallSite call_site)
+{
+#ifdef TD_POSIX
+    try
+    {
+        fs::path refs = detail::refs_path(path);
+        detail::FileDescriptor fd = detail::lock_refs(refs, 0);
+        long count = detail::read_refs(fd.get(), refs);
+        if (count <= 0)
+            throw std::runtime_error("'" + path.string() + "' is being removed");
+        detail::write_refs(fd.get(), refs, count + 1);
+    }
+    catch (const std::exception& ex)
+    {
+        if (config.log_impl)
+            config.log_impl("SharedTempDir attach to '" + path.string() +
+                            "' failed. Error: " + ex.what());
+        throw TempDirException(ex);
+    }
+    std::unique_ptr<TempDir> temp_dir(new TempDir(config, path, nullptr, call_site));
+    temp_dir->log("SharedTempDir attach '", path, "'");
+    return SharedTempDir(share_cross_process(std::move(temp_dir)));
+#else
+    (void)path;
+    (void)config;
+    (void)call_site;
+    throw TempDirException(std::runtime_error("SharedTempDir across processes requires POSIX"));
+#endif
+}
+
+TD_INLINE std::shared_ptr<TempDir> SharedTempDir::share_cross_process(
+    std::unique_ptr<TempDir> temp_dir)
+{
+    // releases the reference of this process, the last process cleans up
+    auto release = [](TempDir* temp_dir) {
+#ifdef TD_POSIX
+        try
+        {
+            fs::path refs = detail::refs_path(temp_dir->path());
+            detail::FileDescriptor fd = detail::lock_refs(refs, 0);
+            long count = detail::read_refs(fd.get(), refs) - 1;
+            detail::write_refs(fd.get(), refs, count > 0 ? count : 0);
+            if (count > 0)
+                temp_dir->_temp_dir.clear();
+            else
+                ::unlink(refs.c_str());
+        }
+        catch (const std::exception& ex)
+        {
+            // another process may still use the directory, so it is kept
+            temp_dir->log("SharedTempDir release failed. Error: ", ex.what());
+            temp_dir->_temp_dir.clear();
+        }
+#endif
+        delete temp_dir;
+    };
+    return std::shared_ptr<TempDir>(temp_dir.release(), release);
+}
+
+struct TraceRecorder::State
+{
+    std::mutex mutex;
+    std::ofstream out;
+    fs::path file;
+    std::vector<unsigned char> buffer;
+    std::uint64_t last_timestamp_ns = 0;
+    std::atomic<std::uint32_t> next_dir_id{1};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
+
+TD_INLINE TraceRecorder::TraceRecorder(const fs::path& file) : _state(std::make_unique<State>())
+{
+    _state->file = file;
+    _state->out.open(file, std::ios::binary | std::ios::trunc);
+    _state->out.write(detail::trace_magic, sizeof(detail::trace_magic));
+    if (!_state->out)
+        throw TempDirException(fs::filesystem_error(
+            "create trace failed", file, std::make_error_code(std::errc::io_error)));
+}
+
+TD_INLINE TraceRecorder::~TraceRecorder()
+{
+    try
+    {
+        flush();
+    }
+    catch (const std::exception&)
+    {
+        // do nothing as rethrowing is not allowed in destructor
+    }
+}
+
+TD_INLINE std::uint64_t TraceRecorder::now_ns() const
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                          std::chrono::steady_clock::now() - _state->start)
+                                          .count());
+}
+
+TD_INLINE std::uint32_t TraceRecorder::next_dir_id() { return _state->next_dir_id++; }
+
+TD_INLINE void TraceRecorder::record(const TraceEvent& event)
+{
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    auto& buffer = _state->buffer;
+
+    // events are recorded when they complete, so timestamps are zigzag encoded deltas
+    auto delta = static_cast<std::int64_t>(event.timestamp_ns - _state->last_timestamp_ns);
+    _state->last_timestamp_ns = event.timestamp_ns;
+
+    buffer.push_back(static_cast<unsigned char>(event.op));
+    detail::append_varint(buffer, (static_cast<std::uint64_t>(delta) << 1) ^
+                                      static_cast<std::uint64_t>(delta >> 63));
+    detail::append_varint(buffer, event.duration_ns);
+    detail::append_varint(buffer, event.thread);
+    detail::append_varint(buffer, event.dir);
+    detail::append_varint(buffer, event.count);
+    detail::append_varint(buffer, event.bytes);
+
+    if (buffer.size() >= 64 * 1024)
+    {
+        _state->out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+        buffer.clear();
+    }
+}
+
+TD_INLINE void TraceRecorder::flush()
+{
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    auto& buffer = _state->buffer;
+    _state->out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    _state->out.flush();
+    buffer.clear();
+    if (!_state->out)
+        throw TempDirException(fs::filesystem_error(
+            "write trace failed", _state->file, std::make_error_code(std::errc::io_error)));
+}
+
+TD_INLINE std::vector<TraceEvent> TraceRecorder::read(const fs::path& file)
+{
+    std::ifstream in(file, std::ios::binary);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)),
+                                    std::istreambuf_iterator<char>());
+    if (data.size() < sizeof(detail::trace_magic) ||
+        !std::equal(std::begin(detail::trace_magic), std::end(detail::trace_magic), data.begin(),
+                    [](char a, unsigned char b) { return static_cast<unsigned char>(a) == b; }))
+        throw TempDirException(std::invalid_argument("'" + file.string() + "' is not a trace"));
+
+    std::vector<TraceEvent> events;
+    const unsigned char* pos = data.data() + sizeof(detail::trace_magic);
+    const unsigned char* end = data.data() + data.size();
+    std::uint64_t timestamp_ns = 0;
+    try
+    {
+        while (pos != end)
+        {
+            TraceEvent event;
+            if (*pos >= trace_op_count)
+                throw std::invalid_argument("'" + file.string() + "' contains unknown operation " +
+                                            std::to_string(*pos));
+            event.op = static_cast<TraceOp>(*pos++);
+            std::uint64_t zigzag = detail::read_varint(pos, end);
+            timestamp_ns += (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+            event.timestamp_ns = timestamp_ns;
+            event.duration_ns = detail::read_varint(pos, end);
+            event.thread = static_cast<std::uint32_t>(detail::read_varint(pos, end));
+            event.dir = static_cast<std::uint32_t>(detail::read_varint(pos, end));
+            event.count = detail::read_varint(pos, end);
+            event.bytes = detail::read_varint(pos, end);
+            events.push_back(event);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        throw TempDirException(ex);
+    }
+    return events;
+}
+
+struct MemoryPressureWatcher::State
+{
+    MemoryPressureOptions options;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stop = false;
+    std::atomic<std::size_t> migrated{0};
+    std::thread thread;
+};
+
+TD_INLINE MemoryPressureWatcher::MemoryPressureWatcher(MemoryPressureOptions options)
+    : _state(std::make_unique<State>())
+{
+    _state->options = options;
+    _state->thread = std::thread([state = _state.get()] {
+        const MemoryPressureOptions& options = state->options;
+        std::unique_lock<std::mutex> lock(state->mutex);
+        while (!state->stop)
+        {
+            lock.unlock();
+            MemoryPressure pressure = sample();
+            bool stalled = options.some_avg10 > 0 && pressure.some_avg10 >= options.some_avg10;
+            bool low = options.min_mem_available > 0 && pressure.mem_available > 0 &&
+                       pressure.mem_available < options.min_mem_available;
+            if (stalled || low)
+                state->migrated += TempDir::Migration::migrate_all();
+            lock.lock();
+            state->wake.wait_for(lock, std::chrono::milliseconds(options.poll_interval_ms),
+                                 [state] { return state->stop; });
+        }
+    });
+}
+
+TD_INLINE MemoryPressureWatcher::~MemoryPressureWatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        _state->stop = true;
+    }
+    _state->wake.notify_all();
+    _state->thread.join();
+}
+
+TD_INLINE std::size_t MemoryPressureWatcher::migrated() const { return _state->migrated; }
+
+TD_INLINE MemoryPressure MemoryPressureWatcher::sample()
+{
+    MemoryPressure pressure;
+
+    // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    std::ifstream psi("/proc/pressure/memory");
+    std::string word;
+    while (psi >> word)
+    {
+        if (word.rfind("avg10=", 0) == 0)
+        {
+            pressure.some_avg10 = std::strtod(word.c_str() + 6, nullptr);
+            break;
+        }
+    }
+
+    // MemAvailable:    8123456 kB
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while (std::getline(meminfo, line))
+    {
+        if (line.rfind("MemAvailable:", 0) == 0)
+        {
+            pressure.mem_available = std::strtoull(line.c_str() + 13, nullptr, 10) * 1024;
+            break;
+        }
+    }
+    return pressure;
+}
+
+struct TempDirPool::State
+{
+    mutable std::mutex mutex;
+    std::vector<fs::path> idle;
+    std::size_t counter = 0;
+};
+
+TD_INLINE TempDirPool::TempDirPool(Config config, std::size_t size)
+    : _root(config), _state(std::make_unique<State>())
+{
+    try
+    {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            fs::path dir = root() / ("pool_" + std::to_string(_state->counter++));
+            fs::create_directory(dir);
+            _state->idle.push_back(dir);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        throw TempDirException(ex);
+    }
+}
+
+TD_INLINE TempDirPool::~TempDirPool()
+{
+    try
+    {
+        if (detail::cleanup_allowed(_root.config().cleanup))
+            detail::remove_contents(root(), 0);
+    }
+    catch (const std::exception&)
+    {
+        // do nothing as rethrowing is not allowed in destructor,
+        // remaining entries are removed by the root TempDir if possible
+    }
+}
+
+TD_INLINE TempDirPool::Lease TempDirPool::acquire(std::string_view name)
+{
+    fs::path dir;
+    std::size_t id;
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        id = _state->counter++;
+        if (!_state->idle.empty())
+        {
+            dir = std::move(_state->idle.back());
+            _state->idle.pop_back();
+        }
+    }
+
+    try
+    {
+        fs::path leased = root() / (detail::sanitize_name(name) + "_" + std::to_string(id));
+        if (dir.empty())
+            fs::create_directory(leased);
+        else
+            fs::rename(dir, leased);
+        return Lease(this, leased);
+    }
+    catch (const std::exception& ex)
+    {
+        throw TempDirException(ex);
+    }
+}
+
+TD_INLINE std::size_t TempDirPool::available() const
+{
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    return _state->idle.size();
+}
+
+TD_INLINE void TempDirPool::give_back(const fs::path& path)
+{
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    fs::path idle = root() / ("pool_" + std::to_string(_state->counter++));
+    fs::rename(path, idle);
+    _state->idle.push_back(idle);
+}
+
+TD_INLINE TempDirPool::Lease::~Lease()
+{
+    try
+    {
+        release();
+    }
+    catch (const std::exception&)
+    {
+        // do nothing as rethrowing is not allowed in destructor,
+        // the directory is removed when the pool is destroyed
+    }
+}
+
+TD_INLINE TempDirPool::Lease::Lease(Lease&& other) noexcept
+    : _pool(std::exchange(other._pool, nullptr)), _path(std::move(other._path))
+{
+}
+
+TD_INLINE TempDirPool::Lease& TempDirPool::Lease::operator=(Lease&& other) noexcept
+{
+    std::swap(_pool, other._pool);
+    std::swap(_path, other._path);
+    return *this;
+}
+
+TD_INLINE void TempDirPool::Lease::reset()
+{
+    try
+    {
+        detail::remove_contents(_path);
+    }
+    catch (const std::exception& ex)
+    {
+        throw TempDirException(ex);
+    }
+}
+
+TD_INLINE void TempDirPool::Lease::release()
+{
+    if (!_pool)
+        return;
+
+    TempDirPool* pool = std::exchange(_pool, nullptr);
+    try
+    {
+        detail::remove_contents(_path);
+        pool->give_back(_path);
+    }
+    catch (const std::exception& ex)
+    {
+        throw TempDirException(ex);
+    }
+}
+
+} // namespace bw::tempdir
+
+#endif
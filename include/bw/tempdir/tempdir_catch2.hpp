@@ -0,0 +1,129 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <bw/tempdir/tempdir.hpp>
+#include <catch2/catch_test_case_info.hpp>
+#include <catch2/interfaces/catch_interfaces_config.hpp>
+#include <catch2/interfaces/catch_interfaces_reporter.hpp>
+#include <catch2/reporters/catch_reporter_event_listener.hpp>
+#include <catch2/reporters/catch_reporter_registrars.hpp>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+// Catch2 integration of TempDir.
+//
+// Including this header registers an event listener providing a temporary directory per test
+// case, accessible via CATCH_TEMP_DIR(). Directories are leased from a pre-warmed TempDirPool,
+// named after the test case and emptied between the runs of a test case for its sections
+// instead of being recreated. The pool root is isolated per --shard-index, so parallel shards
+// never share a parent directory.
+//
+//   TEST_CASE("writes report")
+//   {
+//       auto report = CATCH_TEMP_DIR() / "report.txt";
+//       ...
+//   }
+//
+// Call bw::tempdir::catch2::configure() before the test run to adjust root, prefix, cleanup
+// policy or pool size.
+
+namespace bw::tempdir::catch2
+{
+
+// struct holding the state shared by the listener and CATCH_TEMP_DIR()
+struct State
+{
+    Config config = Config().set_temp_dir_prefix("catch2");
+    std::size_t pool_size = 4;
+    unsigned int shard_index = 0;
+    std::unique_ptr<TempDirPool> pool;
+    std::optional<TempDirPool::Lease> lease;
+    std::string test_name;
+    bool test_running = false;
+
+    static State& instance()
+    {
+        static State state;
+        return state;
+    }
+};
+
+// Configures root, prefix, cleanup policy and logging of the temporary directories
+// as well as the number of pre-created directories. Has to be called before the test run.
+inline void configure(Config config, std::size_t pool_size = 4)
+{
+    State& state = State::instance();
+    state.config = std::move(config);
+    state.pool_size = pool_size;
+}
+
+// Returns the temporary directory of the currently running test case.
+// The directory is leased on first access and emptied before each further run of the test
+// case (one run per leaf section). If no test case is running, a TempDirException is thrown.
+inline const fs::path& current_temp_dir()
+{
+    State& state = State::instance();
+    if (!state.test_running)
+        throw TempDirException(std::logic_error("CATCH_TEMP_DIR() used outside of a test case"));
+
+    if (!state.pool)
+    {
+        Config config = state.config;
+        config.set_temp_dir_prefix(config.temp_dir_prefix + "_shard" +
+                                   std::to_string(state.shard_index));
+        state.pool = std::make_unique<TempDirPool>(config, state.pool_size);
+    }
+
+    if (!state.lease)
+        state.lease = state.pool->acquire(state.test_name);
+
+    return state.lease->path();
+}
+
+// Catch2 event listener managing the per test case temporary directories.
+class TempDirListener : public Catch::EventListenerBase
+{
+  public:
+    using Catch::EventListenerBase::EventListenerBase;
+
+    void testRunStarting(Catch::TestRunInfo const&) override
+    {
+        State::instance().shard_index = m_config->shardIndex();
+    }
+
+    void testCaseStarting(Catch::TestCaseInfo const& test_info) override
+    {
+        State& state = State::instance();
+        state.test_name = test_info.name;
+        state.test_running = true;
+    }
+
+    void testCasePartialStarting(Catch::TestCaseInfo const&, std::uint64_t part_number) override
+    {
+        State& state = State::instance();
+        if (part_number > 0 && state.lease)
+            state.lease->reset();
+    }
+
+    void testCaseEnded(Catch::TestCaseStats const&) override
+    {
+        State& state = State::instance();
+        state.lease = std::nullopt;
+        state.test_running = false;
+    }
+
+    void testRunEnded(Catch::TestRunStats const&) override { State::instance().pool.reset(); }
+};
+
+// registers the listener exactly once, regardless of how many translation units include this
+inline Catch::ListenerRegistrar<TempDirListener> listener_registrar("bw::tempdir::TempDirListener");
+
+} // namespace bw::tempdir::catch2
+
+// Returns the temporary directory (const std::filesystem::path&) of the running test case.
+#define CATCH_TEMP_DIR() ::bw::tempdir::catch2::current_temp_dir()
@@ -0,0 +1,118 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <bw/tempdir/tempdir.hpp>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+// GoogleTest integration of TempDir.
+//
+// Including this header registers a global test environment owning a pre-warmed TempDirPool
+// below one session root. Fixtures deriving from TempDirTest lease a directory per test,
+// named after the test, instead of creating and removing a TempDir member. Leased directories
+// are emptied and returned to the pool after each test, all leftovers are removed in one
+// parallel pass when the environment is torn down. The session root is isolated per
+// GTEST_SHARD_INDEX, so parallel shards never share a parent directory.
+//
+//   class ReportTest : public bw::tempdir::gtest::TempDirTest {};
+//
+//   TEST_F(ReportTest, Writes)
+//   {
+//       auto report = temp_dir() / "report.txt";
+//       ...
+//   }
+//
+// Call bw::tempdir::gtest::configure() before RUN_ALL_TESTS() to adjust root, prefix, cleanup
+// policy or pool size.
+
+namespace bw::tempdir::gtest
+{
+
+// Global test environment owning the pool of temporary directories.
+class TempDirEnvironment : public ::testing::Environment
+{
+  public:
+    // Returns the registered environment.
+    static TempDirEnvironment& instance()
+    {
+        static TempDirEnvironment* environment = static_cast<TempDirEnvironment*>(
+            ::testing::AddGlobalTestEnvironment(new TempDirEnvironment()));
+        return *environment;
+    }
+
+    // Configures root, prefix, cleanup policy and logging of the temporary directories
+    // as well as the number of pre-created directories. Has to be called before the test run.
+    void configure(Config config, std::size_t pool_size = 4)
+    {
+        _config = std::move(config);
+        _pool_size = pool_size;
+    }
+
+    // Creates the pool below the session root.
+    void SetUp() override { pool(); }
+
+    // Removes all pooled and leftover directories in one parallel pass.
+    void TearDown() override { _pool.reset(); }
+
+    // Returns the pool, it is created on first access.
+    // If an error occurs, a TempDirException is thrown.
+    TempDirPool& pool()
+    {
+        if (!_pool)
+        {
+            Config config = _config;
+            const char* shard_index = std::getenv("GTEST_SHARD_INDEX");
+            config.set_temp_dir_prefix(config.temp_dir_prefix + "_shard" +
+                                       (shard_index ? shard_index : "0"));
+            _pool = std::make_unique<TempDirPool>(config, _pool_size);
+        }
+        return *_pool;
+    }
+
+  private:
+    TempDirEnvironment() = default;
+
+    Config _config = Config().set_temp_dir_prefix("gtest");
+    std::size_t _pool_size = 4;
+    std::unique_ptr<TempDirPool> _pool;
+};
+
+// registers the environment exactly once, regardless of how many translation units include this
+inline TempDirEnvironment& environment_registration = TempDirEnvironment::instance();
+
+// Configures the temporary directories of all TempDirTest fixtures,
+// see TempDirEnvironment::configure.
+inline void configure(Config config, std::size_t pool_size = 4)
+{
+    TempDirEnvironment::instance().configure(std::move(config), pool_size);
+}
+
+// Base fixture providing a leased temporary directory per test.
+class TempDirTest : public ::testing::Test
+{
+  protected:
+    // Leases a directory named after the running test.
+    void SetUp() override
+    {
+        const ::testing::TestInfo* info =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        std::string name = info ? std::string(info->test_suite_name()) + "." + info->name() : "";
+        _lease = TempDirEnvironment::instance().pool().acquire(name);
+    }
+
+    // Empties the directory and returns it to the pool.
+    void TearDown() override { _lease.release(); }
+
+    // Returns the temporary directory of the running test.
+    const fs::path& temp_dir() const { return _lease.path(); }
+
+  private:
+    TempDirPool::Lease _lease;
+};
+
+} // namespace bw::tempdir::gtest
@@ -0,0 +1,71 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Thread fan-out shared by the implementation of tempdir.hpp and the header-only extensions.
+// It is kept out of tempdir.hpp's declarations, so the compiled library variant does not pull
+// <thread> into the including translation units.
+
+namespace bw::tempdir::detail
+{
+
+// Runs fn(index) for every index in [0, count) on up to max_threads worker threads.
+// A max_threads value of 0 selects std::thread::hardware_concurrency(). The first exception
+// thrown by any invocation is rethrown on the calling thread after all workers finished.
+template <typename Fn> void parallel_for(std::size_t count, std::size_t max_threads, Fn&& fn)
+{
+    if (max_threads == 0)
+        max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::size_t thread_count = std::min(count, max_threads);
+    if (thread_count <= 1)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+            fn(i);
+        return;
+    }
+
+    std::atomic<std::size_t> next{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&]()
+    {
+        for (std::size_t i = next++; i < count; i = next++)
+        {
+            try
+            {
+                fn(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (std::size_t t = 1; t < thread_count; ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+} // namespace bw::tempdir::detail
@@ -0,0 +1,254 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <bw/tempdir/tempdir.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Replay of TempDir operation traces recorded by TraceRecorder.
+//
+// Each recorded thread is replayed by its own thread, events are started at their original
+// time offsets, so the interleavings of the recorded workload are preserved. The replayed
+// TempDirs are created according to ReplayOptions::config, which allows to evaluate other
+// roots, session mode or cleanup policies against a recorded workload. File operations are
+// re-executed with the recorded number of files and bytes, contents are synthetic.
+//
+//   auto events = TraceRecorder::read("production.trace");
+//   ReplayResult result = replay_trace(events, ReplayOptions().set_config(
+//                                                  Config().set_root_path("/mnt/tmpfs")));
+
+namespace bw::tempdir
+{
+
+// struct holding options for replay_trace
+struct ReplayOptions
+{
+    Config config;      // configuration of the replayed TempDirs
+    double speed = 1.0; // time scale, 2.0 replays twice as fast
+    bool timing = true; // wait for the original start time of each event
+
+    ReplayOptions& set_config(Config config)
+    {
+        this->config = std::move(config);
+        return *this;
+    }
+
+    ReplayOptions& set_speed(double speed)
+    {
+        this->speed = speed;
+        return *this;
+    }
+
+    ReplayOptions& set_timing(bool timing)
+    {
+        this->timing = timing;
+        return *this;
+    }
+};
+
+// struct holding the result of replay_trace
+struct ReplayResult
+{
+    // statistics of one operation type, indexed by TraceOp
+    struct OpStats
+    {
+        std::size_t events = 0;
+        std::uint64_t recorded_ns = 0; // total duration in the trace
+        std::uint64_t replayed_ns = 0; // total duration of the replay
+    };
+
+    std::size_t events = 0;
+    std::size_t threads = 0;
+    std::uint64_t wall_ns = 0;
+    std::array<OpStats, trace_op_count> ops{};
+    std::vector<std::string> errors;
+};
+
+// Returns the name of an operation.
+inline const char* trace_op_name(TraceOp op)
+{
+    static constexpr const char* names[] = {"create", "cleanup",  "write_files",     "materialize",
+                                            "list",   "prefetch", "cache_footprint", "verify"};
+    static_assert(std::size(names) == trace_op_count, "every TraceOp needs a name");
+    auto index = static_cast<std::size_t>(op);
+    return index < std::size(names) ? names[index] : "unknown";
+}
+
+namespace detail
+{
+// TempDirs of a replay shared by the replaying threads
+class ReplayDirs
+{
+  public:
+    void create(std::uint32_t id, const Config& config)
+    {
+        auto temp_dir = std::make_shared<TempDir>(config);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _dirs[id] = std::move(temp_dir);
+        _created.notify_all();
+    }
+
+    // Waits until the directory was created by its replaying thread.
+    std::shared_ptr<TempDir> get(std::uint32_t id)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _created.wait_for(lock, std::chrono::seconds(10), [&] { return _dirs.count(id) > 0; });
+        auto it = _dirs.find(id);
+        if (it == _dirs.end())
+            throw std::runtime_error("directory " + std::to_string(id) + " was never created");
+        return it->second;
+    }
+
+    std::shared_ptr<TempDir> remove(std::uint32_t id)
+    {
+        auto temp_dir = get(id);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _dirs.erase(id);
+        return temp_dir;
+    }
+
+  private:
+    std::mutex _mutex;
+    std::condition_variable _created;
+    std::map<std::uint32_t, std::shared_ptr<TempDir>> _dirs;
+};
+
+// Returns synthetic content of at least the given size.
+inline std::string_view replay_content(std::size_t size)
+{
+    static const std::string content(1 << 20, 'x');
+    thread_local std::string large;
+    if (size <= content.size())
+        return std::string_view(content).substr(0, size);
+    large.assign(size, 'x');
+    return large;
+}
+
+// Re-executes a single event.
+inline void replay_event(const TraceEvent& event, std::size_t sequence, ReplayDirs& dirs,
+                         const Config& config)
+{
+    switch (event.op)
+    {
+    case TraceOp::create:
+        dirs.create(event.dir, config);
+        break;
+    case TraceOp::cleanup:
+        dirs.remove(event.dir)->cleanup();
+        break;
+    case TraceOp::write_files:
+    case TraceOp::materialize:
+    {
+        std::vector<FileSpec> files;
+        std::size_t size = event.count ? static_cast<std::size_t>(event.bytes / event.count) : 0;
+        std::string prefix = "replay_" + std::to_string(event.thread) + "_" +
+                             std::to_string(sequence) + "_";
+        for (std::uint64_t i = 0; i < event.count; ++i)
+            files.push_back({prefix + std::to_string(i), replay_content(size)});
+        dirs.get(event.dir)->write_files(files);
+        break;
+    }
+    case TraceOp::list:
+        dirs.get(event.dir)->list(ListOptions().set_recursive(true));
+        break;
+    case TraceOp::prefetch:
+        dirs.get(event.dir)->prefetch();
+        break;
+    case TraceOp::cache_footprint:
+        dirs.get(event.dir)->cache_footprint();
+        break;
+    case TraceOp::verify:
+        // contents of the original fixture are unknown, reading all files has the same cost
+        dirs.get(event.dir)->prefetch({}, PrefetchOptions().set_wait(true));
+        break;
+    default:
+        throw std::invalid_argument("unknown operation " +
+                                    std::to_string(static_cast<unsigned>(event.op)));
+    }
+}
+} // namespace detail
+
+// Replays the events of a trace with the original concurrency, see tempdir_replay.hpp.
+// Failing events are reported in ReplayResult::errors, TempDirs not cleaned up by the trace are
+// removed at the end of the replay according to the configured cleanup policy.
+inline ReplayResult replay_trace(const std::vector<TraceEvent>& events,
+                                 const ReplayOptions& options = {})
+{
+    std::map<std::uint32_t, std::vector<TraceEvent>> by_thread;
+    for (const auto& event : events)
+        by_thread[event.thread].push_back(event);
+
+    ReplayResult result;
+    result.events = events.size();
+    result.threads = by_thread.size();
+
+    detail::ReplayDirs dirs;
+    std::mutex result_mutex;
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (auto& [thread, thread_events] : by_thread)
+    {
+        std::stable_sort(thread_events.begin(), thread_events.end(),
+                         [](const TraceEvent& a, const TraceEvent& b) {
+                             return a.timestamp_ns < b.timestamp_ns;
+                         });
+        threads.emplace_back([&, &thread_events = thread_events] {
+            for (std::size_t i = 0; i < thread_events.size(); ++i)
+            {
+                const TraceEvent& event = thread_events[i];
+                if (options.timing && options.speed > 0)
+                    std::this_thread::sleep_until(
+                        start + std::chrono::nanoseconds(static_cast<std::int64_t>(
+                                    double(event.timestamp_ns) / options.speed)));
+
+                auto event_start = std::chrono::steady_clock::now();
+                std::string error;
+                try
+                {
+                    detail::replay_event(event, i, dirs, options.config);
+                }
+                catch (const std::exception& ex)
+                {
+                    error = std::string(trace_op_name(event.op)) + " of directory " +
+                            std::to_string(event.dir) + " failed: " + ex.what();
+                }
+                auto elapsed = std::chrono::steady_clock::now() - event_start;
+
+                std::lock_guard<std::mutex> lock(result_mutex);
+                auto op = static_cast<std::size_t>(event.op);
+                if (op < result.ops.size())
+                {
+                    auto& stats = result.ops[op];
+                    ++stats.events;
+                    stats.recorded_ns += event.duration_ns;
+                    stats.replayed_ns += static_cast<std::uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+                }
+                if (!error.empty())
+                    result.errors.push_back(std::move(error));
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    result.wall_ns = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                             start)
+            .count());
+    return result;
+}
+
+} // namespace bw::tempdir
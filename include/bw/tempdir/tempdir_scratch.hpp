@@ -0,0 +1,603 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <bw/tempdir/tempdir.hpp>
+#include <bw/tempdir/tempdir_parallel.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Compressed scratch files for spill and intermediate data.
+//
+// The stream is split into blocks of ScratchOptions::block_size bytes, which are compressed
+// independently by a small built-in LZ77 codec. Independent blocks can be compressed in parallel
+// and read back by index. Blocks the codec cannot shrink are stored as-is, and a writer that sees
+// a run of incompressible blocks only probes every 16th block until data becomes compressible
+// again. The file ends with an index of the block offsets:
+//
+//   header:  "TDSCRAT1" block_size:u32
+//   blocks:  raw_size:u32 stored_size:u32 method:u8 data[stored_size]
+//   index:   offset:u64 per block, block_count:u64, raw_size:u64, "TDSCIDX1"
+//
+//   TempDir temp_dir;
+//   ScratchWriter writer(temp_dir, "spill.tds");
+//   writer.write(records);
+//   writer.close();
+//   ScratchReader reader(temp_dir.path() / "spill.tds");
+//   std::string block = reader.read_block(3);
+
+namespace bw::tempdir
+{
+
+// struct holding options for ScratchWriter
+struct ScratchOptions
+{
+    std::size_t block_size = 64 * 1024; // raw bytes per block, the unit of random access
+    std::size_t threads = 0;            // compression threads, 0 uses all hardware threads
+    bool compression = true;            // false stores all blocks as-is
+
+    ScratchOptions& set_block_size(std::size_t block_size)
+    {
+        this->block_size = block_size;
+        return *this;
+    }
+
+    ScratchOptions& set_threads(std::size_t threads)
+    {
+        this->threads = threads;
+        return *this;
+    }
+
+    ScratchOptions& set_compression(bool compression)
+    {
+        this->compression = compression;
+        return *this;
+    }
+};
+
+namespace detail
+{
+constexpr char scratch_magic[] = "TDSCRAT1";
+constexpr char scratch_index_magic[] = "TDSCIDX1";
+constexpr std::size_t scratch_header_size = 12;
+constexpr std::size_t scratch_block_header_size = 9;
+constexpr std::size_t scratch_footer_size = 24;
+constexpr std::size_t scratch_max_block_size = std::size_t(1) << 24;
+
+// storage method of a block
+enum class ScratchMethod : std::uint8_t
+{
+    stored = 0,
+    lz = 1
+};
+
+inline void store_le(unsigned char* out, std::uint64_t value, std::size_t bytes)
+{
+    for (std::size_t i = 0; i < bytes; ++i)
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+inline std::uint64_t load_le(const unsigned char* in, std::size_t bytes)
+{
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < bytes; ++i)
+        value |= std::uint64_t(in[i]) << (8 * i);
+    return value;
+}
+
+inline std::uint32_t lz_load32(const unsigned char* in)
+{
+    std::uint32_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+inline std::uint64_t lz_load64(const unsigned char* in)
+{
+    std::uint64_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+constexpr std::size_t lz_min_match = 4;
+
+// Appends the extension bytes of a length whose token nibble is 15.
+inline unsigned char* lz_length(unsigned char* out, std::size_t length)
+{
+    if (length < 15)
+        return out;
+    for (length -= 15; length >= 255; length -= 255)
+        *out++ = 255;
+    *out++ = static_cast<unsigned char>(length);
+    return out;
+}
+
+// Writes one sequence of literals followed by a match. The last sequence of a block has no
+// match (match == 0). Returns nullptr if the sequence does not fit.
+inline unsigned char* lz_sequence(unsigned char* out, const unsigned char* end,
+                                  const unsigned char* literals, std::size_t literal_count,
+                                  std::size_t offset, std::size_t match)
+{
+    std::size_t match_code = match ? match - lz_min_match : 0;
+    std::size_t worst = 1 + literal_count + literal_count / 255 + 1 + 2 + match_code / 255 + 1;
+    if (std::size_t(end - out) < worst)
+        return nullptr;
+
+    unsigned char* token = out++;
+    *token = static_cast<unsigned char>((std::min<std::size_t>(literal_count, 15) << 4) |
+                                        std::min<std::size_t>(match_code, 15));
+    out = lz_length(out, literal_count);
+    std::memcpy(out, literals, literal_count);
+    out += literal_count;
+    if (match)
+    {
+        *out++ = static_cast<unsigned char>(offset);
+        *out++ = static_cast<unsigned char>(offset >> 8);
+        out = lz_length(out, match_code);
+    }
+    return out;
+}
+
+// Compresses a block with a greedy LZ77 parse over a 64 KiB window. The format follows LZ4:
+// a token with literal and match length nibbles, literals, a 16 bit offset, extension bytes of
+// lengths >= 15. Returns 0 if the result does not fit into capacity bytes.
+inline std::size_t lz_compress(const unsigned char* src, std::size_t size, unsigned char* dst,
+                               std::size_t capacity)
+{
+    constexpr unsigned hash_bits = 14;
+    constexpr std::size_t tail = 12; // the last bytes are always literals
+    thread_local std::vector<std::uint32_t> table;
+    table.assign(std::size_t(1) << hash_bits, 0); // position + 1, 0 is empty
+
+    unsigned char* out = dst;
+    const unsigned char* out_end = dst + capacity;
+    std::size_t anchor = 0;
+    if (size > tail)
+    {
+        std::size_t limit = size - tail;
+        std::size_t match_limit = size - 5;
+        std::size_t pos = 0;
+        while (pos < limit)
+        {
+            std::uint32_t sequence = lz_load32(src + pos);
+            std::uint32_t hash = (sequence * 2654435761u) >> (32 - hash_bits);
+            std::size_t candidate = table[hash];
+            table[hash] = static_cast<std::uint32_t>(pos + 1);
+            if (candidate == 0 || pos - (candidate - 1) > 65535 ||
+                lz_load32(src + candidate - 1) != sequence)
+            {
+                // step faster through data without matches
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+
+            std::size_t ref = candidate - 1;
+            while (pos > anchor && ref > 0 && src[pos - 1] == src[ref - 1])
+            {
+                --pos;
+                --ref;
+            }
+            std::size_t match = lz_min_match;
+            while (pos + match + 8 <= match_limit &&
+                   lz_load64(src + pos + match) == lz_load64(src + ref + match))
+                match += 8;
+            while (pos + match < match_limit && src[pos + match] == src[ref + match])
+                ++match;
+
+            out = lz_sequence(out, out_end, src + anchor, pos - anchor, pos - ref, match);
+            if (!out)
+                return 0;
+            pos += match;
+            anchor = pos;
+        }
+    }
+    out = lz_sequence(out, out_end, src + anchor, size - anchor, 0, 0);
+    return out ? std::size_t(out - dst) : 0;
+}
+
+// Decompresses a block produced by lz_compress, throws on malformed input.
+inline void lz_decompress(const unsigned char* src, std::size_t size, unsigned char* dst,
+                          std::size_t raw_size)
+{
+    const unsigned char* in = src;
+    const unsigned char* in_end = src + size;
+    unsigned char* out = dst;
+    unsigned char* out_end = dst + raw_size;
+    auto fail = [] { throw std::runtime_error("malformed compressed block"); };
+    auto length = [&](std::size_t value) {
+        if (value == 15)
+        {
+            unsigned char byte;
+            do
+            {
+                if (in == in_end)
+                    fail();
+                byte = *in++;
+                value += byte;
+            } while (byte == 255);
+        }
+        return value;
+    };
+
+    while (in < in_end)
+    {
+        unsigned token = *in++;
+        std::size_t literals = length(token >> 4);
+        if (literals > std::size_t(in_end - in) || literals > std::size_t(out_end - out))
+            fail();
+        if (literals <= 16 && in_end - in >= 16 && out_end - out >= 16)
+            std::memcpy(out, in, 16); // fixed size copies are cheaper than exact ones
+        else
+            std::memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        if (in == in_end)
+            break;
+
+        if (in_end - in < 2)
+            fail();
+        std::size_t offset = std::size_t(in[0]) | (std::size_t(in[1]) << 8);
+        in += 2;
+        std::size_t match = length(token & 15) + lz_min_match;
+        if (offset == 0 || offset > std::size_t(out - dst) || match > std::size_t(out_end - out))
+            fail();
+        const unsigned char* ref = out - offset;
+        if (offset >= 8 && std::size_t(out_end - out) >= match + 8)
+            for (std::size_t i = 0; i < match; i += 8)
+                std::memcpy(out + i, ref + i, 8);
+        else if (offset >= match)
+            std::memcpy(out, ref, match);
+        else
+            for (std::size_t i = 0; i < match; ++i)
+                out[i] = ref[i]; // overlapping copy repeats the last offset bytes
+        out += match;
+    }
+    if (out != out_end)
+        fail();
+}
+
+// Returns the framed representation of a block, compressed if that saves at least 1/32.
+inline std::string scratch_encode_block(std::string_view raw, bool compress)
+{
+    std::string block(scratch_block_header_size + raw.size(), '\0');
+    auto* header = reinterpret_cast<unsigned char*>(block.data());
+    auto* data = header + scratch_block_header_size;
+    const auto* src = reinterpret_cast<const unsigned char*>(raw.data());
+
+    std::size_t stored = compress ? lz_compress(src, raw.size(), data, raw.size() - raw.size() / 32)
+                                  : 0;
+    auto method = stored ? ScratchMethod::lz : ScratchMethod::stored;
+    if (!stored)
+    {
+        std::memcpy(data, src, raw.size());
+        stored = raw.size();
+    }
+    block.resize(scratch_block_header_size + stored);
+    store_le(header, raw.size(), 4);
+    store_le(header + 4, stored, 4);
+    header[8] = static_cast<unsigned char>(method);
+    return block;
+}
+
+inline TempDirException scratch_error(const std::string& message, const fs::path& path)
+{
+    return TempDirException(std::runtime_error(message + " " + path.string()));
+}
+} // namespace detail
+
+// Writes a compressed scratch file, see tempdir_scratch.hpp.
+// Data is buffered until a batch of blocks per thread is complete, the batch is compressed in
+// parallel and written in order. close() writes the last block and the index; the destructor
+// closes the file as well, but ignores errors.
+class ScratchWriter
+{
+  public:
+    explicit ScratchWriter(const fs::path& path, ScratchOptions options = {})
+        : _path(path), _options(options)
+    {
+        if (_options.block_size == 0 || _options.block_size > detail::scratch_max_block_size)
+            throw detail::scratch_error("invalid block size for scratch file", path);
+        if (_options.threads == 0)
+            _options.threads = std::max(1u, std::thread::hardware_concurrency());
+
+        _file.open(path, std::ios::binary | std::ios::trunc);
+        if (!_file)
+            throw detail::scratch_error("cannot create scratch file", path);
+        unsigned char header[detail::scratch_header_size];
+        std::memcpy(header, detail::scratch_magic, 8);
+        detail::store_le(header + 8, _options.block_size, 4);
+        write_bytes(reinterpret_cast<const char*>(header), sizeof(header));
+    }
+
+    // Creates the scratch file with the given name in a temporary directory.
+    ScratchWriter(const TempDir& temp_dir, const fs::path& name, ScratchOptions options = {})
+        : ScratchWriter(temp_dir.path() / name, options)
+    {
+    }
+
+    ScratchWriter(const ScratchWriter&) = delete;
+    ScratchWriter& operator=(const ScratchWriter&) = delete;
+
+    ~ScratchWriter()
+    {
+        try
+        {
+            close();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    // Appends data to the stream.
+    void write(std::string_view data)
+    {
+        if (_closed)
+            throw detail::scratch_error("write to closed scratch file", _path);
+        std::size_t batch = _options.block_size * _options.threads * 4;
+        while (!data.empty())
+        {
+            std::size_t count = std::min(data.size(), batch - _pending.size());
+            _pending.append(data.data(), count);
+            data.remove_prefix(count);
+            if (_pending.size() == batch)
+                flush(batch);
+        }
+    }
+
+    // Writes the remaining data and the block index.
+    void close()
+    {
+        if (_closed)
+            return;
+        _closed = true;
+        flush(_pending.size());
+
+        std::vector<unsigned char> index(_offsets.size() * 8 + detail::scratch_footer_size);
+        for (std::size_t i = 0; i < _offsets.size(); ++i)
+            detail::store_le(index.data() + i * 8, _offsets[i], 8);
+        unsigned char* footer = index.data() + _offsets.size() * 8;
+        detail::store_le(footer, _offsets.size(), 8);
+        detail::store_le(footer + 8, _raw_size, 8);
+        std::memcpy(footer + 16, detail::scratch_index_magic, 8);
+        write_bytes(reinterpret_cast<const char*>(index.data()), index.size());
+        _file.close();
+        if (!_file)
+            throw detail::scratch_error("cannot write scratch file", _path);
+    }
+
+    const fs::path& path() const { return _path; }
+
+    // Uncompressed bytes written so far.
+    std::uint64_t raw_size() const { return _raw_size + _pending.size(); }
+
+    // Bytes in the file, including framing and index after close().
+    std::uint64_t file_size() const { return _file_size; }
+
+    std::size_t block_count() const { return _offsets.size(); }
+
+    // Number of blocks stored uncompressed.
+    std::size_t stored_blocks() const { return _stored_blocks; }
+
+  private:
+    void write_bytes(const char* data, std::size_t size)
+    {
+        _file.write(data, static_cast<std::streamsize>(size));
+        if (!_file)
+            throw detail::scratch_error("cannot write scratch file", _path);
+        _file_size += size;
+    }
+
+    // Compresses and writes the first bytes of the pending data.
+    void flush(std::size_t bytes)
+    {
+        std::size_t block_size = _options.block_size;
+        std::size_t count = (bytes + block_size - 1) / block_size;
+        std::vector<std::string> blocks(count);
+        std::string_view pending(_pending);
+        std::size_t first = _offsets.size();
+
+        auto encode = [&](std::size_t i) {
+            // after a run of incompressible blocks only every 16th block is probed
+            bool compress = _options.compression &&
+                            (_stored_run < 8 || (first + i) % 16 == 0);
+            blocks[i] = detail::scratch_encode_block(
+                pending.substr(i * block_size, std::min(block_size, bytes - i * block_size)),
+                compress);
+        };
+        detail::parallel_for(count, _options.threads, encode);
+
+        for (const auto& block : blocks)
+        {
+            bool stored = block[8] == char(detail::ScratchMethod::stored);
+            _stored_blocks += stored;
+            _stored_run = stored ? _stored_run + 1 : 0;
+            _offsets.push_back(_file_size);
+            write_bytes(block.data(), block.size());
+        }
+        _raw_size += bytes;
+        _pending.erase(0, bytes);
+    }
+
+    fs::path _path;
+    ScratchOptions _options;
+    std::ofstream _file;
+    std::string _pending;
+    std::vector<std::uint64_t> _offsets;
+    std::uint64_t _raw_size = 0;
+    std::uint64_t _file_size = 0;
+    std::size_t _stored_blocks = 0;
+    std::size_t _stored_run = 0;
+    bool _closed = false;
+};
+
+// Reads a scratch file written by ScratchWriter, sequentially or by block index.
+// Malformed files are reported by TempDirException.
+class ScratchReader
+{
+  public:
+    explicit ScratchReader(const fs::path& path)
+        : _path(path), _file(path, std::ios::binary)
+    {
+        if (!_file)
+            throw detail::scratch_error("cannot open scratch file", path);
+
+        unsigned char header[detail::scratch_header_size];
+        unsigned char footer[detail::scratch_footer_size];
+        _file.seekg(0, std::ios::end);
+        auto file_size = static_cast<std::uint64_t>(_file.tellg());
+        if (file_size < sizeof(header) + sizeof(footer))
+            throw detail::scratch_error("truncated scratch file", path);
+        read_at(0, header, sizeof(header));
+        read_at(file_size - sizeof(footer), footer, sizeof(footer));
+        if (std::memcmp(header, detail::scratch_magic, 8) != 0 ||
+            std::memcmp(footer + 16, detail::scratch_index_magic, 8) != 0)
+            throw detail::scratch_error("not a scratch file", path);
+
+        _block_size = static_cast<std::size_t>(detail::load_le(header + 8, 4));
+        std::uint64_t count = detail::load_le(footer, 8);
+        _size = detail::load_le(footer + 8, 8);
+        std::uint64_t available = file_size - sizeof(header) - sizeof(footer);
+        if (_block_size == 0 || _block_size > detail::scratch_max_block_size ||
+            count > available / 8 ||
+            _size > count * _block_size || (count && _size <= (count - 1) * _block_size))
+            throw detail::scratch_error("malformed scratch file index", path);
+
+        _index_offset = file_size - sizeof(footer) - count * 8;
+        std::vector<unsigned char> index(count * 8);
+        read_at(_index_offset, index.data(), index.size());
+        _offsets.resize(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            _offsets[i] = detail::load_le(index.data() + i * 8, 8);
+            std::uint64_t min = i ? _offsets[i - 1] + detail::scratch_block_header_size
+                                  : sizeof(header);
+            if (_offsets[i] < min || _offsets[i] >= _index_offset)
+                throw detail::scratch_error("malformed scratch file index", path);
+        }
+    }
+
+    std::size_t block_count() const { return _offsets.size(); }
+
+    std::size_t block_size() const { return _block_size; }
+
+    // Uncompressed size of the stream.
+    std::uint64_t size() const { return _size; }
+
+    // Returns the uncompressed contents of a block.
+    std::string read_block(std::size_t index) { return std::string(load(index)); }
+
+    // Reads up to size bytes at the current position, returns the number of bytes read.
+    std::size_t read(char* data, std::size_t size)
+    {
+        std::size_t done = 0;
+        while (done < size && _position < _size)
+        {
+            std::string_view block = load(static_cast<std::size_t>(_position / _block_size));
+            std::size_t offset = static_cast<std::size_t>(_position % _block_size);
+            std::size_t count = std::min(size - done, block.size() - offset);
+            std::memcpy(data + done, block.data() + offset, count);
+            done += count;
+            _position += count;
+        }
+        return done;
+    }
+
+    // Moves the read position, the block containing it is located by the index.
+    void seek(std::uint64_t position) { _position = std::min(position, _size); }
+
+    std::uint64_t tell() const { return _position; }
+
+    // Returns the whole uncompressed stream.
+    std::string read_all()
+    {
+        std::string result;
+        result.reserve(static_cast<std::size_t>(_size));
+        for (std::size_t i = 0; i < _offsets.size(); ++i)
+            result += load(i);
+        return result;
+    }
+
+  private:
+    void read_at(std::uint64_t offset, void* data, std::size_t size)
+    {
+        _file.seekg(static_cast<std::streamoff>(offset));
+        _file.read(static_cast<char*>(data), static_cast<std::streamsize>(size));
+        if (!_file)
+            throw detail::scratch_error("cannot read scratch file", _path);
+    }
+
+    // Decodes a block into the block cache.
+    std::string_view load(std::size_t index)
+    {
+        if (index >= _offsets.size())
+            throw detail::scratch_error("block index " + std::to_string(index) +
+                                            " out of range in scratch file",
+                                        _path);
+        if (index == _cached)
+            return _block;
+
+        std::uint64_t end = index + 1 < _offsets.size() ? _offsets[index + 1] : _index_offset;
+        std::uint64_t expected_raw =
+            std::min<std::uint64_t>(_block_size, _size - std::uint64_t(index) * _block_size);
+        unsigned char header[detail::scratch_block_header_size];
+        read_at(_offsets[index], header, sizeof(header));
+        std::uint64_t raw_size = detail::load_le(header, 4);
+        std::uint64_t stored_size = detail::load_le(header + 4, 4);
+        auto method = static_cast<detail::ScratchMethod>(header[8]);
+        if (raw_size != expected_raw ||
+            _offsets[index] + sizeof(header) + stored_size != end ||
+            (method == detail::ScratchMethod::stored && stored_size != raw_size) ||
+            (method != detail::ScratchMethod::stored && method != detail::ScratchMethod::lz))
+            throw detail::scratch_error("malformed block " + std::to_string(index) + " in",
+                                        _path);
+
+        _cached = std::string::npos;
+        _stored.resize(static_cast<std::size_t>(stored_size));
+        read_at(_offsets[index] + sizeof(header), _stored.data(), _stored.size());
+        if (method == detail::ScratchMethod::stored)
+        {
+            _block.swap(_stored);
+        }
+        else
+        {
+            _block.resize(static_cast<std::size_t>(raw_size));
+            try
+            {
+                detail::lz_decompress(reinterpret_cast<const unsigned char*>(_stored.data()),
+                                      _stored.size(),
+                                      reinterpret_cast<unsigned char*>(_block.data()),
+                                      _block.size());
+            }
+            catch (const std::exception& ex)
+            {
+                throw detail::scratch_error(std::string(ex.what()) + " " +
+                                                std::to_string(index) + " in",
+                                            _path);
+            }
+        }
+        _cached = index;
+        return _block;
+    }
+
+    fs::path _path;
+    std::ifstream _file;
+    std::size_t _block_size = 0;
+    std::uint64_t _size = 0;
+    std::uint64_t _index_offset = 0;
+    std::uint64_t _position = 0;
+    std::vector<std::uint64_t> _offsets;
+    std::size_t _cached = std::string::npos;
+    std::string _block;
+    std::string _stored;
+};
+
+} // namespace bw::tempdir
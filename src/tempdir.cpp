@@ -0,0 +1,10 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+// Translation unit of the compiled tempdir library.
+// It compiles the implementation part of tempdir.hpp exactly once, consumers of the library
+// define TD_COMPILED_LIBRARY and only see the declarations.
+
+#define TD_IMPLEMENTATION
+#include <bw/tempdir/tempdir.hpp>
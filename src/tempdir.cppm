@@ -0,0 +1,48 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+// C++20 module interface unit of TempDir.
+// Usage: import bw.tempdir;
+
+module;
+
+#include <bw/tempdir/tempdir.hpp>
+
+export module bw.tempdir;
+
+export namespace bw::tempdir
+{
+using bw::tempdir::CacheFootprint;
+using bw::tempdir::CallSite;
+using bw::tempdir::Cleanup;
+using bw::tempdir::CleanupStrategy;
+using bw::tempdir::Config;
+using bw::tempdir::EntryType;
+using bw::tempdir::FileSpec;
+using bw::tempdir::Fixture;
+using bw::tempdir::FixtureEntry;
+using bw::tempdir::FootprintOptions;
+using bw::tempdir::Listing;
+using bw::tempdir::ListOptions;
+using bw::tempdir::log;
+using bw::tempdir::MaterializeOptions;
+using bw::tempdir::MemoryPressure;
+using bw::tempdir::MemoryPressureOptions;
+using bw::tempdir::MemoryPressureWatcher;
+using bw::tempdir::PathBuilder;
+using bw::tempdir::PrefetchOptions;
+using bw::tempdir::PrefetchResult;
+using bw::tempdir::RootInfo;
+using bw::tempdir::SharedTempDir;
+using bw::tempdir::SlowOperation;
+using bw::tempdir::TempDir;
+using bw::tempdir::TempDirException;
+using bw::tempdir::TempDirPool;
+using bw::tempdir::TraceEvent;
+using bw::tempdir::TraceOp;
+using bw::tempdir::trace_op_count;
+using bw::tempdir::TraceRecorder;
+using bw::tempdir::VerifyOptions;
+using bw::tempdir::WriteOptions;
+} // namespace bw::tempdir
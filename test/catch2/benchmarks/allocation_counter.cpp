@@ -0,0 +1,25 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include "allocation_counter.hpp"
+#include <cstdlib>
+#include <new>
+
+std::atomic<std::size_t>& AllocationCounter::count()
+{
+    static std::atomic<std::size_t> allocations{0};
+    return allocations;
+}
+
+void* operator new(std::size_t size)
+{
+    AllocationCounter::count().fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
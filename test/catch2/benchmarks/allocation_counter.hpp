@@ -0,0 +1,21 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// counts heap allocations performed via global operator new within the benchmark executable
+struct AllocationCounter
+{
+    static std::atomic<std::size_t>& count();
+
+    AllocationCounter() : start(count().load()) {}
+
+    // allocations performed since construction of this counter
+    std::size_t allocations() const { return count().load() - start; }
+
+    std::size_t start;
+};
@@ -0,0 +1,179 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+// Compares TempDir with hand-written code based on mkdtemp, std::tmpfile and raw syscalls,
+// so the overhead the library adds over the kernel stays visible.
+//
+// Per-op time, allocations and syscalls are reported by the "[benchmark]" test. Syscalls are
+// counted with perf_event_open (see SyscallCounter) and reported as n/a where the kernel does not
+// permit it. The syscalls of a single operation can then be broken down under strace instead:
+//   strace -f -c ./benchmarks "[.syscalls]" -c "TempDir create/destroy"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include "allocation_counter.hpp"
+#include "syscall_counter.hpp"
+#include <bw/tempdir/tempdir.hpp>
+#include <catch2/catch_all.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <ftw.h>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace bw::tempdir;
+namespace fs = std::filesystem;
+
+namespace
+{
+constexpr std::size_t iterations = 2000;
+constexpr const char file_content[] = "content";
+
+// root directories to compare, tmpfs is only used if available
+std::vector<std::pair<std::string, fs::path>> roots()
+{
+    std::vector<std::pair<std::string, fs::path>> result;
+    const char* disk = std::getenv("TD_BENCH_DISK_ROOT");
+    result.emplace_back("disk", disk ? fs::path(disk) : fs::temp_directory_path());
+    if (fs::is_directory("/dev/shm"))
+        result.emplace_back("tmpfs", "/dev/shm");
+    return result;
+}
+
+std::string mkdtemp_template(const fs::path& root) { return (root / "raw_XXXXXX").string(); }
+
+int remove_entry(const char* path, const struct stat*, int, struct FTW*) { return ::remove(path); }
+
+// operation creating and removing one temporary directory (optionally with one file)
+struct Operation
+{
+    std::string name;
+    std::function<void(const fs::path& root)> run;
+};
+
+std::vector<Operation> operations(TempDirPool& pool)
+{
+    return {
+        {"TempDir create/destroy", [](const fs::path& root) { TempDir temp_dir(root); }},
+        {"TempDir session create/destroy",
+         [](const fs::path& root) {
+             TempDir temp_dir(Config().set_root_path(root).set_session(true));
+         }},
+        {"TempDirPool lease/release", [&pool](const fs::path&) { pool.acquire("bench"); }},
+        {"mkdtemp + rmdir",
+         [](const fs::path& root) {
+             std::string dir = mkdtemp_template(root);
+             if (::mkdtemp(dir.data()))
+                 ::rmdir(dir.c_str());
+         }},
+        {"mkdir + rmdir",
+         [](const fs::path& root) {
+             static std::size_t counter = 0;
+             std::string dir = (root / ("raw_" + std::to_string(counter++))).string();
+             if (::mkdir(dir.c_str(), 0700) == 0)
+                 ::rmdir(dir.c_str());
+         }},
+        {"std::tmpfile + fclose",
+         [](const fs::path&) {
+             if (std::FILE* file = std::tmpfile())
+                 std::fclose(file);
+         }},
+        {"TempDir + 1 file via write_files",
+         [](const fs::path& root) {
+             TempDir temp_dir(root);
+             temp_dir.write_files({{"file.txt", file_content}});
+         }},
+        {"mkdtemp + openat/write + unlinkat + rmdir",
+         [](const fs::path& root) {
+             std::string dir = mkdtemp_template(root);
+             if (!::mkdtemp(dir.data()))
+                 return;
+             int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+             int fd = ::openat(dir_fd, "file.txt", O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+             (void)!::write(fd, file_content, sizeof(file_content) - 1);
+             ::close(fd);
+             ::unlinkat(dir_fd, "file.txt", 0);
+             ::close(dir_fd);
+             ::rmdir(dir.c_str());
+         }},
+        {"mkdtemp + write + nftw removal",
+         [](const fs::path& root) {
+             std::string dir = mkdtemp_template(root);
+             if (!::mkdtemp(dir.data()))
+                 return;
+             std::string file = dir + "/file.txt";
+             int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+             (void)!::write(fd, file_content, sizeof(file_content) - 1);
+             ::close(fd);
+             ::nftw(dir.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+         }},
+    };
+}
+} // namespace
+
+TEST_CASE("TempDir overhead over mkdtemp and raw syscalls", "[benchmark]")
+{
+    for (const auto& [root_name, root] : roots())
+    {
+        TempDirPool pool(Config().set_root_path(root), 1);
+        std::ostringstream report;
+        report << "root " << root_name << " (" << root.string() << ")\n";
+        for (const auto& operation : operations(pool))
+        {
+            SyscallCounter syscall_counter;
+            AllocationCounter counter;
+            auto start = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < iterations; ++i)
+                operation.run(root);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            std::uint64_t syscalls = syscall_counter.syscalls();
+
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+            report << "  " << operation.name << ": " << ns / std::int64_t(iterations)
+                   << " ns/op, " << double(counter.allocations()) / double(iterations)
+                   << " allocations/op, ";
+            if (syscall_counter.available())
+                report << double(syscalls) / double(iterations) << " syscalls/op\n";
+            else
+                report << "syscalls n/a\n";
+        }
+        WARN(report.str());
+    }
+}
+
+TEST_CASE("TempDir compared to mkdtemp and raw syscalls", "[!benchmark]")
+{
+    for (const auto& [root_name, root] : roots())
+    {
+        TempDirPool pool(Config().set_root_path(root), 1);
+        for (const auto& operation : operations(pool))
+        {
+            BENCHMARK(operation.name + " on " + root_name)
+            {
+                return operation.run(root);
+            };
+        }
+    }
+}
+
+TEST_CASE("Syscall profile of a single operation", "[.syscalls]")
+{
+    fs::path root = roots().front().second;
+    TempDirPool pool(Config().set_root_path(root), 1);
+    for (const auto& operation : operations(pool))
+    {
+        DYNAMIC_SECTION(operation.name)
+        {
+            for (std::size_t i = 0; i < iterations; ++i)
+                operation.run(root);
+        }
+    }
+}
+
+#endif
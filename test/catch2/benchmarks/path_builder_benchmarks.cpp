@@ -0,0 +1,69 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include "allocation_counter.hpp"
+#include <bw/tempdir/tempdir.hpp>
+#include <catch2/catch_all.hpp>
+
+using namespace bw::tempdir;
+namespace fs = std::filesystem;
+
+constexpr std::size_t child_count = 1000000;
+
+// file names used as children, prepared up front so only path building is measured
+std::vector<fs::path::string_type> child_names()
+{
+    std::vector<fs::path::string_type> names;
+    names.reserve(child_count);
+    for (std::size_t i = 0; i < child_count; ++i)
+        names.push_back(fs::path("file_" + std::to_string(i) + ".txt").native());
+    return names;
+}
+
+TEST_CASE("PathBuilder does not allocate per child path", "[benchmark]")
+{
+    TempDir temp_dir;
+    auto names = child_names();
+    PathBuilder builder = temp_dir.path_builder();
+
+    std::size_t total_length = 0;
+    AllocationCounter builder_counter;
+    for (const auto& name : names)
+        total_length += builder.native(name).size();
+    std::size_t builder_allocations = builder_counter.allocations();
+
+    AllocationCounter join_counter;
+    for (const auto& name : names)
+        total_length -= (temp_dir.path() / name).native().size();
+    std::size_t join_allocations = join_counter.allocations();
+
+    WARN("PathBuilder allocations: " << builder_allocations
+                                     << ", fs::path::operator/ allocations: " << join_allocations);
+    REQUIRE(total_length == 0);
+    REQUIRE(builder_allocations == 0);
+    REQUIRE(join_allocations >= child_count);
+}
+
+TEST_CASE("PathBuilder compared to fs::path::operator/", "[!benchmark]")
+{
+    TempDir temp_dir;
+    auto names = child_names();
+
+    BENCHMARK("fs::path::operator/ for 10^6 children")
+    {
+        std::size_t length = 0;
+        for (const auto& name : names)
+            length += (temp_dir.path() / name).native().size();
+        return length;
+    };
+
+    BENCHMARK("PathBuilder for 10^6 children")
+    {
+        PathBuilder builder = temp_dir.path_builder();
+        std::size_t length = 0;
+        for (const auto& name : names)
+            length += builder.native(name).size();
+        return length;
+    };
+}
@@ -0,0 +1,179 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+// Throughput of compressed scratch files on representative spill data, compared with writing
+// and reading the same bytes through plain std::fstream. The "[benchmark]" test reports MB/s of
+// the uncompressed stream and the compression ratio, the "[!benchmark]" test measures the block
+// codec alone. Set TD_BENCH_DISK_ROOT to choose the directory of the scratch files.
+
+#include <bw/tempdir/tempdir_scratch.hpp>
+#include <catch2/catch_all.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <thread>
+
+using namespace bw::tempdir;
+namespace fs = std::filesystem;
+
+namespace
+{
+constexpr std::size_t stream_size = 32 << 20;
+
+// log lines with timestamps, levels, request ids and a small vocabulary
+std::string log_data(std::size_t size)
+{
+    static const char* levels[] = {"INFO", "INFO", "INFO", "WARN", "DEBUG", "ERROR"};
+    static const char* components[] = {"http.server", "db.pool", "cache", "scheduler", "auth"};
+    static const char* messages[] = {"request completed", "connection acquired",
+                                     "cache miss for key", "job scheduled", "token refreshed",
+                                     "retrying after timeout"};
+    std::mt19937 random(1);
+    std::string data;
+    std::uint64_t millis = 1714564800000;
+    while (data.size() < size)
+    {
+        millis += random() % 50;
+        data += std::to_string(millis) + " " + levels[random() % 6] + " [" +
+                components[random() % 5] + "] " + messages[random() % 6] +
+                " id=" + std::to_string(random() % 1000000) +
+                " duration_ms=" + std::to_string(random() % 2000) + "\n";
+    }
+    data.resize(size);
+    return data;
+}
+
+// sorted run of CSV rows as spilled by an external sort
+std::string csv_data(std::size_t size)
+{
+    std::mt19937 random(2);
+    std::string data;
+    std::uint64_t key = 0;
+    while (data.size() < size)
+    {
+        key += random() % 16;
+        data += std::to_string(key) + "," + std::to_string(random() % 100) + "," +
+                std::to_string(random() % 10000) + ".00,EUR,DE\n";
+    }
+    data.resize(size);
+    return data;
+}
+
+// incompressible bytes, e.g. already compressed media
+std::string random_data(std::size_t size)
+{
+    std::mt19937_64 random(3);
+    std::string data(size, '\0');
+    for (std::size_t i = 0; i + 8 <= size; i += 8)
+    {
+        std::uint64_t value = random();
+        std::memcpy(&data[i], &value, 8);
+    }
+    return data;
+}
+
+struct Dataset
+{
+    std::string name;
+    std::string data;
+};
+
+std::vector<Dataset> datasets()
+{
+    return {{"log lines", log_data(stream_size)},
+            {"csv rows", csv_data(stream_size)},
+            {"random bytes", random_data(stream_size)}};
+}
+
+fs::path bench_root()
+{
+    const char* disk = std::getenv("TD_BENCH_DISK_ROOT");
+    return disk ? fs::path(disk) : fs::temp_directory_path();
+}
+
+double seconds(const std::function<void()>& run)
+{
+    auto start = std::chrono::steady_clock::now();
+    run();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double mb_per_s(std::size_t bytes, double seconds) { return double(bytes) / 1e6 / seconds; }
+} // namespace
+
+TEST_CASE("Scratch file throughput on representative data", "[benchmark]")
+{
+    TempDir temp_dir(bench_root());
+    std::ostringstream report;
+    report << "scratch files of " << (stream_size >> 20) << " MiB in " << temp_dir.path().string()
+           << ", " << std::max(1u, std::thread::hardware_concurrency()) << " threads\n";
+    for (const auto& [name, data] : datasets())
+    {
+        fs::path plain = temp_dir.path() / "plain.bin";
+        fs::path scratch = temp_dir.path() / "scratch.tds";
+        std::string read(data.size(), '\0');
+
+        double plain_write = seconds([&] {
+            std::ofstream(plain, std::ios::binary).write(data.data(), std::streamsize(data.size()));
+        });
+        double plain_read = seconds([&] {
+            std::ifstream(plain, std::ios::binary).read(read.data(), std::streamsize(read.size()));
+        });
+
+        std::uint64_t file_size = 0;
+        std::size_t stored_blocks = 0;
+        double scratch_write = seconds([&] {
+            ScratchWriter writer(scratch);
+            for (std::size_t i = 0; i < data.size(); i += 1 << 20)
+                writer.write(std::string_view(data).substr(i, 1 << 20));
+            writer.close();
+            file_size = writer.file_size();
+            stored_blocks = writer.stored_blocks();
+        });
+        double scratch_read = seconds([&] {
+            ScratchReader reader(scratch);
+            reader.read(read.data(), read.size());
+        });
+        REQUIRE(read == data);
+
+        report << "  " << name << ": ratio " << double(data.size()) / double(file_size) << ", "
+               << stored_blocks << " blocks stored as-is\n"
+               << "    write " << mb_per_s(data.size(), scratch_write) << " MB/s (plain "
+               << mb_per_s(data.size(), plain_write) << " MB/s), read "
+               << mb_per_s(data.size(), scratch_read) << " MB/s (plain "
+               << mb_per_s(data.size(), plain_read) << " MB/s)\n";
+    }
+    WARN(report.str());
+}
+
+TEST_CASE("Scratch block codec", "[!benchmark]")
+{
+    for (const auto& [name, data] : datasets())
+    {
+        std::string_view block = std::string_view(data).substr(0, 64 * 1024);
+        std::string encoded = detail::scratch_encode_block(block, true);
+        std::string decoded(block.size(), '\0');
+
+        BENCHMARK("encode 64 KiB block of " + name)
+        {
+            return detail::scratch_encode_block(block, true);
+        };
+        if (encoded[8] == char(detail::ScratchMethod::lz))
+        {
+            BENCHMARK("decode 64 KiB block of " + name)
+            {
+                detail::lz_decompress(
+                    reinterpret_cast<const unsigned char*>(encoded.data()) +
+                        detail::scratch_block_header_size,
+                    encoded.size() - detail::scratch_block_header_size,
+                    reinterpret_cast<unsigned char*>(decoded.data()), decoded.size());
+                return decoded[0];
+            };
+        }
+    }
+}
@@ -0,0 +1,84 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+
+#if defined(__linux__)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// counts the syscalls entered by the calling thread and the threads it starts afterwards via the
+// raw_syscalls:sys_enter tracepoint of perf_event_open. Without tracefs, or if
+// kernel.perf_event_paranoid does not permit tracepoints, the counter is not available.
+class SyscallCounter
+{
+  public:
+    SyscallCounter()
+    {
+#if defined(__linux__)
+        std::uint64_t id = tracepoint_id();
+        if (id == 0)
+            return;
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = id;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_hv = 1;
+        _fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (_fd >= 0)
+        {
+            ::ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    ~SyscallCounter()
+    {
+#if defined(__linux__)
+        if (_fd >= 0)
+            ::close(_fd);
+#endif
+    }
+
+    SyscallCounter(const SyscallCounter&) = delete;
+    SyscallCounter& operator=(const SyscallCounter&) = delete;
+
+    bool available() const { return _fd >= 0; }
+
+    // syscalls entered since construction of this counter, 0 if not available
+    std::uint64_t syscalls() const
+    {
+        std::uint64_t count = 0;
+#if defined(__linux__)
+        if (_fd >= 0 && ::read(_fd, &count, sizeof(count)) != sizeof(count))
+            count = 0;
+#endif
+        return count;
+    }
+
+  private:
+    static std::uint64_t tracepoint_id()
+    {
+        for (const char* tracefs : {"/sys/kernel/tracing", "/sys/kernel/debug/tracing"})
+        {
+            std::uint64_t id = 0;
+            if (std::ifstream(std::string(tracefs) + "/events/raw_syscalls/sys_enter/id") >> id)
+                return id;
+        }
+        return 0;
+    }
+
+    int _fd = -1;
+};
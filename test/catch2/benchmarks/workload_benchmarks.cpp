@@ -0,0 +1,88 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include "workload_generator.hpp"
+#include <bw/tempdir/tempdir.hpp>
+#include <catch2/catch_all.hpp>
+#include <memory>
+#include <sstream>
+
+using namespace bw::tempdir;
+namespace fs = std::filesystem;
+
+TEST_CASE("Workload generator builds reproducible trees", "[benchmark]")
+{
+    WorkloadProfile profile = WorkloadProfile::node_modules(2000);
+    WorkloadPlan plan = plan_workload(profile);
+    WorkloadStats stats = plan.stats();
+    REQUIRE(stats.files + stats.symlinks + stats.hardlinks == 2000);
+    REQUIRE(stats.hardlinks > 0);
+    REQUIRE(stats.symlinks > 0);
+    REQUIRE(plan_workload(profile).entries.size() == plan.entries.size());
+    REQUIRE(plan_workload(profile).entries.back().path == plan.entries.back().path);
+
+    TempDir temp_dir;
+    generate_workload(temp_dir.path(), plan);
+    REQUIRE(temp_dir.list(ListOptions().set_recursive(true)).size() ==
+            stats.directories + 2000);
+
+    // the captured shape of the generated tree resembles the profile
+    WorkloadProfile captured = WorkloadProfile::capture(temp_dir.path());
+    REQUIRE(captured.files == 2000);
+    REQUIRE(captured.max_depth <= profile.max_depth);
+    REQUIRE(captured.hardlink_ratio > 0.0);
+    REQUIRE(captured.symlink_ratio > 0.0);
+
+    std::stringstream stored;
+    captured.save(stored);
+    WorkloadProfile loaded = WorkloadProfile::load(stored);
+    REQUIRE(loaded.files == captured.files);
+    REQUIRE(loaded.fan_out == captured.fan_out);
+    REQUIRE(loaded.sizes.size() == captured.sizes.size());
+}
+
+TEST_CASE("TempDir cleanup on realistic trees", "[!benchmark]")
+{
+    WorkloadPlan plan = plan_workload(WorkloadProfile::node_modules());
+
+    BENCHMARK_ADVANCED("cleanup of node_modules-like tree created externally")
+    (Catch::Benchmark::Chronometer meter)
+    {
+        std::vector<std::unique_ptr<TempDir>> dirs;
+        for (int i = 0; i < meter.runs(); ++i)
+        {
+            dirs.push_back(std::make_unique<TempDir>());
+            generate_workload(dirs.back()->path(), plan);
+        }
+        meter.measure([&](int i) { dirs[i]->cleanup(); });
+    };
+
+    BENCHMARK_ADVANCED("cleanup of node_modules-like tree created via write_files")
+    (Catch::Benchmark::Chronometer meter)
+    {
+        std::vector<std::unique_ptr<TempDir>> dirs;
+        for (int i = 0; i < meter.runs(); ++i)
+        {
+            dirs.push_back(std::make_unique<TempDir>());
+            generate_workload(*dirs.back(), plan);
+        }
+        meter.measure([&](int i) { dirs[i]->cleanup(); });
+    };
+}
+
+TEST_CASE("TempDir traversal on realistic trees", "[!benchmark]")
+{
+    TempDir temp_dir;
+    generate_workload(temp_dir, plan_workload(WorkloadProfile::node_modules()));
+
+    BENCHMARK("recursive list of node_modules-like tree")
+    {
+        return temp_dir.list(ListOptions().set_recursive(true)).size();
+    };
+
+    BENCHMARK("capture shape of node_modules-like tree")
+    {
+        return WorkloadProfile::capture(temp_dir.path()).files;
+    };
+}
@@ -0,0 +1,288 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include "workload_generator.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <random>
+#include <set>
+#include <string_view>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+// offsets into the content buffer, so files of equal size differ in content
+constexpr std::size_t content_offsets = 4096;
+
+// Returns pseudo-random content large enough for the largest file plus an offset.
+const std::string& content_buffer(std::uint64_t max_size)
+{
+    static std::string buffer;
+    if (buffer.size() < max_size + content_offsets)
+    {
+        std::mt19937 gen(7);
+        buffer.resize(max_size + content_offsets);
+        for (char& c : buffer)
+            c = static_cast<char>('a' + gen() % 26);
+    }
+    return buffer;
+}
+
+std::string_view content(const WorkloadEntry& entry, std::size_t index)
+{
+    return std::string_view(content_buffer(entry.size))
+        .substr(index % content_offsets, entry.size);
+}
+
+std::uint64_t max_size(const WorkloadPlan& plan)
+{
+    std::uint64_t size = 0;
+    for (const auto& entry : plan.entries)
+        size = std::max(size, entry.size);
+    return size;
+}
+
+void create_link(const fs::path& dir, const WorkloadEntry& entry)
+{
+    if (entry.kind == WorkloadEntry::Kind::hardlink)
+        fs::create_hard_link(dir / entry.target, dir / entry.path);
+    else
+        fs::create_symlink(entry.target.lexically_relative(entry.path.parent_path()),
+                           dir / entry.path);
+}
+} // namespace
+
+WorkloadProfile WorkloadProfile::node_modules(std::size_t files)
+{
+    WorkloadProfile profile;
+    profile.files = files;
+    profile.max_depth = 14;
+    profile.fan_out = 12;
+    profile.sizes = {{128, 25}, {1024, 35}, {8192, 30}, {65536, 9}, {1 << 20, 1}};
+    profile.symlink_ratio = 0.01;
+    profile.hardlink_ratio = 0.05;
+    return profile;
+}
+
+WorkloadProfile WorkloadProfile::capture(const fs::path& dir)
+{
+    WorkloadProfile profile;
+    profile.max_depth = 0;
+    std::size_t files = 0, symlinks = 0;
+    double extra_links = 0;
+    std::map<std::uint64_t, double> histogram;
+    std::map<fs::path, std::size_t> subdirectories;
+
+    for (auto it = fs::recursive_directory_iterator(dir); it != fs::recursive_directory_iterator();
+         ++it)
+    {
+        const fs::directory_entry& entry = *it;
+        profile.max_depth = std::max<std::size_t>(profile.max_depth, it.depth());
+        if (entry.is_symlink())
+        {
+            ++files;
+            ++symlinks;
+        }
+        else if (entry.is_directory())
+        {
+            ++subdirectories[entry.path().parent_path()];
+        }
+        else if (entry.is_regular_file())
+        {
+            ++files;
+            std::uint64_t bucket = 1;
+            while (bucket < entry.file_size())
+                bucket <<= 1;
+            histogram[bucket] += 1;
+
+            // a file with n links contributes (n - 1) / n extra links, without tracking inodes
+            auto links = entry.hard_link_count();
+            extra_links += links > 1 ? double(links - 1) / double(links) : 0.0;
+        }
+    }
+
+    profile.files = files;
+    profile.sizes.clear();
+    for (const auto& [max_bytes, count] : histogram)
+        profile.sizes.push_back({max_bytes, count});
+    if (profile.sizes.empty())
+        profile.sizes.push_back({1, 1});
+
+    std::size_t total_subdirectories = 0;
+    for (const auto& [parent, count] : subdirectories)
+        total_subdirectories += count;
+    profile.fan_out = subdirectories.empty()
+                          ? 1
+                          : std::max<std::size_t>(1, static_cast<std::size_t>(std::lround(
+                                                         double(total_subdirectories) /
+                                                         double(subdirectories.size()))));
+    profile.symlink_ratio = files ? double(symlinks) / double(files) : 0.0;
+    profile.hardlink_ratio = files ? extra_links / double(files) : 0.0;
+    return profile;
+}
+
+void WorkloadProfile::save(std::ostream& out) const
+{
+    out << "files " << files << "\n";
+    out << "max_depth " << max_depth << "\n";
+    out << "fan_out " << fan_out << "\n";
+    out << "symlink_ratio " << symlink_ratio << "\n";
+    out << "hardlink_ratio " << hardlink_ratio << "\n";
+    out << "seed " << seed << "\n";
+    for (const auto& bucket : sizes)
+        out << "size " << bucket.max_bytes << " " << bucket.weight << "\n";
+}
+
+WorkloadProfile WorkloadProfile::load(std::istream& in)
+{
+    WorkloadProfile profile;
+    profile.sizes.clear();
+    std::string key;
+    while (in >> key)
+    {
+        if (key == "files")
+            in >> profile.files;
+        else if (key == "max_depth")
+            in >> profile.max_depth;
+        else if (key == "fan_out")
+            in >> profile.fan_out;
+        else if (key == "symlink_ratio")
+            in >> profile.symlink_ratio;
+        else if (key == "hardlink_ratio")
+            in >> profile.hardlink_ratio;
+        else if (key == "seed")
+            in >> profile.seed;
+        else if (key == "size")
+        {
+            SizeBucket bucket{};
+            in >> bucket.max_bytes >> bucket.weight;
+            profile.sizes.push_back(bucket);
+        }
+    }
+    return profile;
+}
+
+WorkloadStats WorkloadPlan::stats() const
+{
+    WorkloadStats stats;
+    stats.directories = directories.size();
+    for (const auto& entry : entries)
+    {
+        switch (entry.kind)
+        {
+        case WorkloadEntry::Kind::file:
+            ++stats.files;
+            stats.bytes += entry.size;
+            break;
+        case WorkloadEntry::Kind::symlink:
+            ++stats.symlinks;
+            break;
+        case WorkloadEntry::Kind::hardlink:
+            ++stats.hardlinks;
+            break;
+        }
+    }
+    return stats;
+}
+
+WorkloadPlan plan_workload(const WorkloadProfile& profile)
+{
+    std::mt19937_64 gen(profile.seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::size_t fan_out = std::max<std::size_t>(1, profile.fan_out);
+    std::uniform_int_distribution<std::size_t> child(0, fan_out - 1);
+    std::vector<double> weights;
+    for (const auto& bucket : profile.sizes)
+        weights.push_back(bucket.weight);
+    std::discrete_distribution<std::size_t> bucket(weights.begin(), weights.end());
+
+    // descending one more level is geometric, the mean depth is half of the maximum depth
+    double half_depth = double(profile.max_depth) / 2.0;
+    double descend = half_depth / (1.0 + half_depth);
+
+    WorkloadPlan plan;
+    std::set<fs::path> directories;
+    std::vector<std::size_t> regular_files;
+    for (std::size_t i = 0; i < profile.files; ++i)
+    {
+        fs::path dir;
+        for (std::size_t depth = 0; depth < profile.max_depth && unit(gen) < descend; ++depth)
+        {
+            dir /= "d" + std::to_string(child(gen));
+            if (directories.insert(dir).second)
+                plan.directories.push_back(dir);
+        }
+
+        WorkloadEntry entry;
+        double kind = unit(gen);
+        if (!regular_files.empty() && kind < profile.hardlink_ratio)
+            entry.kind = WorkloadEntry::Kind::hardlink;
+        else if (!regular_files.empty() && kind < profile.hardlink_ratio + profile.symlink_ratio)
+            entry.kind = WorkloadEntry::Kind::symlink;
+
+        if (entry.kind == WorkloadEntry::Kind::file)
+        {
+            std::uint64_t max_bytes = profile.sizes[bucket(gen)].max_bytes;
+            entry.path = dir / ("f" + std::to_string(i) + ".dat");
+            entry.size = max_bytes <= 1 ? max_bytes
+                                        : std::uniform_int_distribution<std::uint64_t>(
+                                              max_bytes / 2 + 1, max_bytes)(gen);
+            regular_files.push_back(plan.entries.size());
+        }
+        else
+        {
+            std::uniform_int_distribution<std::size_t> pick(0, regular_files.size() - 1);
+            entry.path = dir / ("l" + std::to_string(i));
+            entry.target = plan.entries[regular_files[pick(gen)]].path;
+        }
+        plan.entries.push_back(std::move(entry));
+    }
+    return plan;
+}
+
+void generate_workload(const fs::path& dir, const WorkloadPlan& plan)
+{
+    content_buffer(max_size(plan));
+    for (const auto& directory : plan.directories)
+        fs::create_directory(dir / directory);
+
+    for (std::size_t i = 0; i < plan.entries.size(); ++i)
+    {
+        const WorkloadEntry& entry = plan.entries[i];
+        if (entry.kind != WorkloadEntry::Kind::file)
+        {
+            create_link(dir, entry);
+            continue;
+        }
+        std::string_view data = content(entry, i);
+        std::ofstream(dir / entry.path, std::ios::binary).write(data.data(), data.size());
+    }
+}
+
+void generate_workload(const bw::tempdir::TempDir& temp_dir, const WorkloadPlan& plan)
+{
+    content_buffer(max_size(plan));
+    std::vector<bw::tempdir::FileSpec> files;
+    for (std::size_t i = 0; i < plan.entries.size(); ++i)
+    {
+        const WorkloadEntry& entry = plan.entries[i];
+        if (entry.kind == WorkloadEntry::Kind::file)
+            files.push_back({entry.path, content(entry, i)});
+    }
+    temp_dir.write_files(files);
+
+    // write_files only creates the parents of files, not those of links
+    for (const auto& entry : plan.entries)
+    {
+        if (entry.kind == WorkloadEntry::Kind::file)
+            continue;
+        fs::create_directories(temp_dir.path() / entry.path.parent_path());
+        create_link(temp_dir.path(), entry);
+    }
+}
@@ -0,0 +1,94 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <bw/tempdir/tempdir.hpp>
+#include <cstdint>
+#include <filesystem>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Synthetic directory trees for benchmarks on realistic shapes.
+//
+// A WorkloadProfile describes the shape of a tree by a parameterized distribution, either set up
+// by hand or captured from an existing directory. plan_workload() turns it into a deterministic
+// list of entries for a given seed, which can be written to any directory or through
+// TempDir::write_files.
+
+// distribution of a directory tree
+struct WorkloadProfile
+{
+    // bucket of the file size histogram, files get a size in (max_bytes / 2, max_bytes]
+    struct SizeBucket
+    {
+        std::uint64_t max_bytes;
+        double weight;
+    };
+
+    std::size_t files = 10000;      // number of files, including links
+    std::size_t max_depth = 8;      // maximum nesting of directories
+    std::size_t fan_out = 8;        // subdirectories per directory
+    std::vector<SizeBucket> sizes = {{256, 40}, {4096, 40}, {65536, 18}, {1 << 20, 2}};
+    double symlink_ratio = 0.0;     // share of files that are symlinks to other files
+    double hardlink_ratio = 0.0;    // share of files that are hardlinks to other files
+    std::uint32_t seed = 42;
+
+    // Returns a node_modules-like profile: deep nesting, many tiny files, some hardlinks.
+    static WorkloadProfile node_modules(std::size_t files = 20000);
+
+    // Captures the shape of an existing directory tree.
+    static WorkloadProfile capture(const std::filesystem::path& dir);
+
+    // Writes the profile as text, so captured shapes can be stored and replayed.
+    void save(std::ostream& out) const;
+
+    // Reads a profile written by save().
+    static WorkloadProfile load(std::istream& in);
+};
+
+// entry of a planned tree, paths are relative to the target directory
+struct WorkloadEntry
+{
+    enum class Kind
+    {
+        file,
+        symlink,
+        hardlink
+    };
+
+    std::filesystem::path path;
+    Kind kind = Kind::file;
+    std::uint64_t size = 0;        // file only
+    std::filesystem::path target;  // links only, relative to the target directory
+};
+
+// struct summarizing a planned tree
+struct WorkloadStats
+{
+    std::size_t files = 0;
+    std::size_t symlinks = 0;
+    std::size_t hardlinks = 0;
+    std::size_t directories = 0;
+    std::uint64_t bytes = 0;
+};
+
+// planned tree: directories in creation order (parents first) and entries
+struct WorkloadPlan
+{
+    std::vector<std::filesystem::path> directories;
+    std::vector<WorkloadEntry> entries;
+
+    WorkloadStats stats() const;
+};
+
+// Plans the tree described by the profile, the result only depends on the profile.
+WorkloadPlan plan_workload(const WorkloadProfile& profile);
+
+// Creates the planned tree below dir with plain filesystem calls, like an external tool would.
+void generate_workload(const std::filesystem::path& dir, const WorkloadPlan& plan);
+
+// Creates the planned tree in the temporary directory, files are written via write_files.
+void generate_workload(const bw::tempdir::TempDir& temp_dir, const WorkloadPlan& plan);
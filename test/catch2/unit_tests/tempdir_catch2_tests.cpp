@@ -0,0 +1,41 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <bw/tempdir/tempdir_catch2.hpp>
+#include <catch2/catch_all.hpp>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+TEST_CASE("CATCH_TEMP_DIR provides directory named after test case")
+{
+    const fs::path& temp_dir = CATCH_TEMP_DIR();
+    REQUIRE(fs::is_directory(temp_dir));
+    REQUIRE(temp_dir.filename().string().find("CATCH_TEMP_DIR_provides_directory") == 0);
+    REQUIRE(temp_dir.parent_path().filename().string().find("catch2_shard0") == 0);
+
+    // same directory on repeated access within one test case
+    REQUIRE(CATCH_TEMP_DIR() == temp_dir);
+}
+
+TEST_CASE("CATCH_TEMP_DIR is emptied between sections")
+{
+    REQUIRE(fs::is_empty(CATCH_TEMP_DIR()));
+
+    SECTION("First section writes file")
+    {
+        std::ofstream(CATCH_TEMP_DIR() / "first.txt") << "first";
+        REQUIRE(fs::exists(CATCH_TEMP_DIR() / "first.txt"));
+    }
+
+    SECTION("Second section does not see file of first section")
+    {
+        REQUIRE_FALSE(fs::exists(CATCH_TEMP_DIR() / "first.txt"));
+    }
+}
+
+TEST_CASE("CATCH_TEMP_DIR of previous test case is emptied and recycled")
+{
+    REQUIRE(fs::is_empty(CATCH_TEMP_DIR()));
+}
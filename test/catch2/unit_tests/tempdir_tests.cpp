@@ -3,7 +3,16 @@
 // SPDX-License-Identifier: MIT
 
 #include <bw/tempdir/tempdir.hpp>
+#include <bw/tempdir/tempdir_replay.hpp>
+#include <bw/tempdir/tempdir_scratch.hpp>
 #include <catch2/catch_all.hpp>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <memory_resource>
+#include <random>
+#include <sstream>
+#include <thread>
 
 using namespace bw::tempdir;
 namespace fs = std::filesystem;
@@ -135,6 +144,26 @@ TEST_CASE("TempDir throws exception when directory cleanup fails")
                            MessageMatches(StartsWith("TempDirExcepton:")));
 }
 
+TEST_CASE("TempDir cleanup removes read-only subdirectories")
+{
+    if constexpr (!is_win32)
+    {
+        TempDir temp_dir;
+        fs::path path = temp_dir.path();
+        temp_dir.write_files({{"journaled/a.txt", "a"}, {"journaled/b.txt", "b"}});
+        fs::create_directories(path / "external/nested");
+        std::ofstream(path / "external/nested/c.txt") << "c";
+
+        fs::permissions(path / "journaled", fs::perms::owner_read | fs::perms::owner_exec);
+        fs::permissions(path / "external/nested", fs::perms::none);
+        fs::permissions(path / "external", fs::perms::owner_read | fs::perms::owner_exec);
+        fs::permissions(path, fs::perms::owner_read | fs::perms::owner_exec);
+
+        REQUIRE_NOTHROW(temp_dir.cleanup());
+        REQUIRE_FALSE(fs::exists(path));
+    }
+}
+
 TEST_CASE("TempDir does not throw exception when cleanup in destructor fails")
 {
     fs::path root_path = fs::temp_directory_path() / "some-sub-dir";
@@ -316,3 +345,1063 @@ TEST_CASE("TempDir allows to enable custom logging")
     REQUIRE(log[1].find("TempDir remove") != std::string::npos);
     REQUIRE(log[1].find(temp_dir_path.string()) != std::string::npos);
 }
+
+TEST_CASE("TempDir prefetch reports files and bytes contained in temporary directory")
+{
+    TempDir temp_dir;
+    fs::create_directories(temp_dir.path() / "sub");
+    std::ofstream(temp_dir.path() / "a.txt") << std::string(5000, 'a');
+    std::ofstream(temp_dir.path() / "sub" / "b.txt") << std::string(3000, 'b');
+
+    SECTION("Prefetch all files")
+    {
+        PrefetchResult result = temp_dir.prefetch();
+        REQUIRE(result.files == 2);
+        REQUIRE(result.total_bytes == 8000);
+        REQUIRE(result.resident_bytes_before <= result.total_bytes);
+    }
+
+    SECTION("Prefetch selected paths relative to temporary directory")
+    {
+        PrefetchResult result = temp_dir.prefetch({"sub"}, PrefetchOptions().set_threads(1));
+        REQUIRE(result.files == 1);
+        REQUIRE(result.total_bytes == 3000);
+    }
+
+    SECTION("Prefetch and wait until files are resident")
+    {
+        PrefetchResult result = temp_dir.prefetch({}, PrefetchOptions().set_wait(true));
+        REQUIRE(result.files == 2);
+        if constexpr (!is_win32)
+            REQUIRE(result.resident_bytes_after == result.total_bytes);
+    }
+
+    SECTION("Prefetch of missing path throws")
+    {
+        REQUIRE_THROWS_AS(temp_dir.prefetch({"missing"}), TempDirException);
+    }
+}
+
+TEST_CASE("TempDir reports page cache footprint of temporary directory")
+{
+    TempDir temp_dir;
+    for (int i = 0; i < 10; ++i)
+        std::ofstream(temp_dir.path() / ("file_" + std::to_string(i))) << std::string(4096, 'x');
+
+    SECTION("Inspect all files")
+    {
+        CacheFootprint footprint = temp_dir.cache_footprint();
+        REQUIRE(footprint.files == 10);
+        REQUIRE(footprint.inspected_files == 10);
+        REQUIRE_FALSE(footprint.estimated);
+        REQUIRE(footprint.total_bytes == 10 * 4096);
+        REQUIRE(footprint.resident_bytes <= footprint.total_bytes);
+        REQUIRE(footprint.dirty_bytes <= footprint.resident_bytes);
+    }
+
+    SECTION("Estimate footprint from sample")
+    {
+        CacheFootprint footprint = temp_dir.cache_footprint(FootprintOptions().set_max_files(5));
+        REQUIRE(footprint.files == 10);
+        REQUIRE(footprint.inspected_files == 5);
+        REQUIRE(footprint.estimated);
+        REQUIRE(footprint.total_bytes == 10 * 4096);
+    }
+}
+
+std::string read_file(const fs::path& file_path)
+{
+    std::ifstream file(file_path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+TEST_CASE("TempDir writes batch of files")
+{
+    TempDir temp_dir;
+
+    SECTION("Files and required directories are created")
+    {
+        std::vector<std::string> contents;
+        for (int i = 0; i < 100; ++i)
+            contents.push_back("content " + std::to_string(i));
+
+        std::vector<FileSpec> files;
+        for (int i = 0; i < 100; ++i)
+        {
+            fs::path dir = fs::path("dir_" + std::to_string(i % 3)) / "nested";
+            files.push_back({dir / ("file_" + std::to_string(i) + ".txt"), contents[i]});
+        }
+        files.push_back({"top_level.txt", ""});
+
+        temp_dir.write_files(files);
+
+        for (int i = 0; i < 100; ++i)
+            REQUIRE(read_file(temp_dir.path() / files[i].path) == contents[i]);
+        REQUIRE(fs::file_size(temp_dir.path() / "top_level.txt") == 0);
+    }
+
+    SECTION("Existing files are overwritten")
+    {
+        std::ofstream(temp_dir.path() / "file.txt") << "some longer previous content";
+        temp_dir.write_files({{"file.txt", "new"}}, WriteOptions().set_threads(1));
+        REQUIRE(read_file(temp_dir.path() / "file.txt") == "new");
+    }
+
+    SECTION("Paths escaping temporary directory are rejected")
+    {
+        REQUIRE_THROWS_AS(temp_dir.write_files({{"../escaped.txt", "x"}}), TempDirException);
+        REQUIRE_THROWS_AS(temp_dir.write_files({{temp_dir.path() / "abs.txt", "x"}}),
+                          TempDirException);
+        REQUIRE_FALSE(fs::exists(temp_dir.path().parent_path() / "escaped.txt"));
+    }
+}
+
+TEST_CASE("TempDir materializes and verifies fixtures")
+{
+    TempDir temp_dir;
+
+    SECTION("Fixture declared from constexpr entries")
+    {
+        static constexpr FixtureEntry layout[] = {
+            FixtureEntry::dir("logs"),
+            FixtureEntry::file("config/app.json", R"({"debug": true})"),
+            FixtureEntry::file("data/a.csv", "id,value"),
+        };
+        Fixture fixture(layout);
+
+        temp_dir.materialize(fixture);
+
+        REQUIRE(fs::is_directory(temp_dir.path() / "logs"));
+        REQUIRE(read_file(temp_dir.path() / "config" / "app.json") == R"({"debug": true})");
+        REQUIRE(temp_dir.verify(fixture, VerifyOptions().set_exact(true)).empty());
+    }
+
+    SECTION("Fixture with nested fixtures and generated content")
+    {
+        Fixture fixture = Fixture()
+                              .file("readme.txt", "hello")
+                              .dir("src", Fixture().file("main.cpp", "int main() {}").dir("empty"))
+                              .file("big.bin", [] { return std::string(10000, 'b'); });
+
+        temp_dir.materialize(fixture);
+
+        REQUIRE(read_file(temp_dir.path() / "src" / "main.cpp") == "int main() {}");
+        REQUIRE(fs::is_directory(temp_dir.path() / "src" / "empty"));
+        REQUIRE(fs::file_size(temp_dir.path() / "big.bin") == 10000);
+        REQUIRE(temp_dir.verify(fixture, VerifyOptions().set_exact(true)).empty());
+    }
+
+    SECTION("Files with identical content can be deduplicated with hardlinks")
+    {
+        Fixture fixture = Fixture().file("a/1.txt", "same").file("b/2.txt", "same").file(
+            "c/3.txt", "other");
+
+        temp_dir.materialize(fixture, MaterializeOptions().set_deduplicate(true));
+
+        REQUIRE(read_file(temp_dir.path() / "b" / "2.txt") == "same");
+        REQUIRE(fs::hard_link_count(temp_dir.path() / "a" / "1.txt") == 2);
+        REQUIRE(fs::hard_link_count(temp_dir.path() / "c" / "3.txt") == 1);
+        REQUIRE(temp_dir.verify(fixture).empty());
+    }
+
+    SECTION("Differences to fixture are reported")
+    {
+        Fixture fixture = Fixture().file("a.txt", "a").file("b.txt", "b").dir("dir");
+        temp_dir.materialize(fixture);
+
+        std::ofstream(temp_dir.path() / "a.txt") << "changed";
+        fs::remove(temp_dir.path() / "b.txt");
+        fs::remove(temp_dir.path() / "dir");
+        std::ofstream(temp_dir.path() / "extra.txt") << "extra";
+
+        REQUIRE(temp_dir.verify(fixture).size() == 3);
+
+        auto differences = temp_dir.verify(fixture, VerifyOptions().set_exact(true));
+        REQUIRE(differences.size() == 4);
+        REQUIRE(differences[0].find("a.txt") != std::string::npos);
+        REQUIRE(differences[1].find("missing file") != std::string::npos);
+        REQUIRE(differences[2].find("missing directory") != std::string::npos);
+        REQUIRE(differences[3].find("unexpected entry 'extra.txt'") != std::string::npos);
+    }
+
+    SECTION("Errors during verification are reported as TempDirException")
+    {
+        temp_dir.materialize(Fixture().file("a.txt", "a").dir("locked"));
+        Fixture failing = Fixture().file("a.txt", []() -> std::string {
+            throw std::runtime_error("generator failed");
+        });
+        REQUIRE_THROWS_AS(temp_dir.verify(failing), TempDirException);
+
+        if constexpr (!is_win32)
+        {
+            fs::permissions(temp_dir.path() / "locked", fs::perms::none);
+            std::ofstream probe(temp_dir.path() / "locked" / "probe");
+            if (!probe) // not running with privileges bypassing permissions
+                REQUIRE_THROWS_AS(temp_dir.verify(Fixture().file("a.txt", "a").dir("locked"),
+                                                  VerifyOptions().set_exact(true)),
+                                  TempDirException);
+            fs::permissions(temp_dir.path() / "locked", fs::perms::owner_all);
+        }
+    }
+}
+
+TEST_CASE("TempDir lists directory entries sorted by name")
+{
+    TempDir temp_dir;
+    for (int i = 9; i >= 0; --i)
+        std::ofstream(temp_dir.path() / ("file_" + std::to_string(i)));
+    fs::create_directories(temp_dir.path() / "sub" / "deeper");
+    std::ofstream(temp_dir.path() / "sub" / "nested.txt");
+    std::ofstream(temp_dir.path() / "sub" / "deeper" / "leaf.txt");
+
+    SECTION("List direct entries")
+    {
+        Listing listing = temp_dir.list();
+        REQUIRE(listing.size() == 11);
+        REQUIRE(listing.name(0) == "file_0");
+        REQUIRE(listing.name(9) == "file_9");
+        REQUIRE(listing.type(0) == EntryType::file);
+        REQUIRE(listing.name(10) == "sub");
+        REQUIRE(listing.type(10) == EntryType::directory);
+        if constexpr (!is_win32)
+            REQUIRE(listing.inode(0) != 0);
+    }
+
+    SECTION("List recursively")
+    {
+        Listing listing = temp_dir.list(ListOptions().set_recursive(true));
+        auto names = listing.names();
+        REQUIRE(names.size() == 14);
+        REQUIRE(std::is_sorted(names.begin(), names.end()));
+        REQUIRE(names[10] == "sub");
+        REQUIRE(names[11] == "sub/deeper");
+        REQUIRE(names[12] == "sub/deeper/leaf.txt");
+        REQUIRE(names[13] == "sub/nested.txt");
+    }
+
+    SECTION("List empty directory")
+    {
+        TempDir empty_dir;
+        REQUIRE(empty_dir.list().empty());
+    }
+}
+
+TEST_CASE("TempDir cleanup removes journaled and untracked entries")
+{
+    fs::path temp_path;
+    {
+        TempDir temp_dir;
+        temp_path = temp_dir.path();
+        temp_dir.write_files({{"a/b/file.txt", "content"}, {"a/other.txt", "content"}});
+        temp_dir.materialize(Fixture().dir("c", Fixture().file("d.txt", "x")));
+
+        std::ofstream(temp_path / "a" / "b" / "untracked.txt") << "content";
+        std::ofstream(temp_path / "untracked.txt") << "content";
+        fs::remove(temp_path / "a" / "other.txt");
+        fs::create_directories(temp_path / "a" / "other.txt" / "nested");
+        fs::remove_all(temp_path / "c");
+
+        temp_dir.cleanup();
+        REQUIRE_FALSE(fs::exists(temp_path));
+    }
+    REQUIRE_FALSE(fs::exists(temp_path));
+}
+
+TEST_CASE("TempDir cleanup does not follow journaled directories replaced by symlinks")
+{
+    if constexpr (is_win32)
+        return;
+
+    TempDir outside;
+    std::ofstream(outside.path() / "file.txt") << "outside";
+    auto strategy = GENERATE(CleanupStrategy::serial, CleanupStrategy::parallel);
+
+    fs::path temp_path;
+    {
+        TempDir temp_dir(Config().set_cleanup_strategy(strategy));
+        temp_path = temp_dir.path();
+        temp_dir.write_files({{"a/file.txt", "content"}, {"a/b/file.txt", "content"}});
+        fs::remove_all(temp_path / "a");
+        fs::create_directory_symlink(outside.path(), temp_path / "a");
+        fs::create_directory(outside.path() / "b");
+        std::ofstream(outside.path() / "b" / "file.txt") << "outside";
+    }
+    REQUIRE_FALSE(fs::exists(temp_path));
+    REQUIRE(read_file(outside.path() / "file.txt") == "outside");
+    REQUIRE(read_file(outside.path() / "b" / "file.txt") == "outside");
+}
+
+TEST_CASE("TempDir provides path builder for entries in temporary directory")
+{
+    TempDir temp_dir;
+    PathBuilder builder = temp_dir.path_builder();
+
+    REQUIRE(fs::path(builder.native(fs::path("a.txt").native())) == temp_dir.path() / "a.txt");
+    REQUIRE(fs::path(builder.c_str(fs::path("sub/b.txt").make_preferred().native())) ==
+            temp_dir.path() / "sub" / "b.txt");
+    REQUIRE(builder.path(fs::path("c.txt").native()) == temp_dir.path() / "c.txt");
+
+    std::ofstream(builder.c_str(fs::path("file.txt").native())) << "content";
+    REQUIRE(read_file(temp_dir.path() / "file.txt") == "content");
+}
+
+// memory resource counting allocations forwarded to the default resource
+struct CountingResource : std::pmr::memory_resource
+{
+    std::atomic<std::size_t> allocations{0};
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        ++allocations;
+        return std::pmr::get_default_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+    {
+        std::pmr::get_default_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+TEST_CASE("TempDir allocates from configured memory resource")
+{
+    CountingResource resource;
+    TempDir temp_dir(Config().set_memory_resource(&resource));
+    std::size_t after_creation = resource.allocations;
+
+    temp_dir.materialize(Fixture().file("a/1.txt", "1").file("b/2.txt", "2"));
+    REQUIRE(resource.allocations > after_creation);
+
+    std::size_t before_listing = resource.allocations;
+    Listing listing = temp_dir.list(ListOptions().set_recursive(true));
+    REQUIRE(listing.size() == 4);
+    REQUIRE(listing.memory_resource() == &resource);
+    REQUIRE(resource.allocations > before_listing);
+
+    SECTION("Monotonic arena can be used as memory resource")
+    {
+        std::pmr::monotonic_buffer_resource arena;
+        TempDir arena_dir(Config().set_memory_resource(&arena));
+        arena_dir.materialize(Fixture().file("x/y/z.txt", "z").dir("empty"));
+        REQUIRE(arena_dir.list(ListOptions().set_recursive(true)).size() == 4);
+    }
+}
+
+TEST_CASE("TempDirPool leases and recycles directories")
+{
+    fs::path root_path;
+    {
+        TempDirPool pool(Config().set_temp_dir_prefix("pool"), 2);
+        root_path = pool.root();
+        REQUIRE(fs::is_directory(root_path));
+        REQUIRE(pool.available() == 2);
+
+        {
+            TempDirPool::Lease lease = pool.acquire("my test: with spaces");
+            REQUIRE(lease);
+            REQUIRE(fs::is_directory(lease.path()));
+            REQUIRE(lease.path().parent_path() == root_path);
+            REQUIRE(lease.path().filename().string().find("my_test__with_spaces") == 0);
+            REQUIRE(pool.available() == 1);
+
+            std::ofstream(lease.path() / "file.txt") << "content";
+            fs::create_directories(lease.path() / "sub" / "dir");
+
+            lease.reset();
+            REQUIRE(fs::is_directory(lease.path()));
+            REQUIRE(fs::is_empty(lease.path()));
+
+            std::ofstream(lease.path() / "leftover.txt") << "content";
+        }
+        REQUIRE(pool.available() == 2);
+
+        auto lease_1 = pool.acquire("one");
+        auto lease_2 = pool.acquire("two");
+        auto lease_3 = pool.acquire("three");
+        REQUIRE(pool.available() == 0);
+        REQUIRE(fs::is_empty(lease_1.path()));
+        REQUIRE(fs::is_empty(lease_2.path()));
+        REQUIRE(fs::is_directory(lease_3.path()));
+
+        lease_3.release();
+        REQUIRE_FALSE(lease_3);
+        REQUIRE(pool.available() == 1);
+    }
+    REQUIRE_FALSE(fs::exists(root_path));
+}
+
+TEST_CASE("TempDir nests temporary directories in a session")
+{
+    fs::path root_path = fs::temp_directory_path();
+    Config config = Config().set_temp_dir_prefix("td_session_test").set_session(true);
+
+    SECTION("temporary directories share one session directory")
+    {
+        TempDir first(config);
+        TempDir second(config);
+        fs::path session = first.path().parent_path();
+        REQUIRE(session == second.path().parent_path());
+        REQUIRE(session.parent_path() == root_path);
+        REQUIRE(session.filename().string().find("td_session_test_session_") == 0);
+
+        TempDir kept(Config(config).set_cleanup(Cleanup::never));
+        REQUIRE(kept.path().parent_path() == root_path);
+        fs::remove_all(kept.path());
+    }
+
+#ifdef __linux__
+    SECTION("sessions of exited processes are reaped")
+    {
+        std::string ns = fs::read_symlink("/proc/self/ns/pid").string();
+        ns = ns.substr(ns.find('[') + 1, ns.find(']') - ns.find('[') - 1);
+        auto session = [&](const std::string& pid_and_start) {
+            return root_path / ("td_session_test_session_" + pid_and_start + "_" + ns);
+        };
+        std::string own_pid = fs::read_symlink("/proc/self").string();
+        fs::path live = TempDir(config).path().parent_path();
+
+        fs::create_directories(session("999999999_1") / "dir");
+        fs::create_directories(session("999999998_1").concat(".removing"));
+        fs::create_directories(session("999999997_1"));
+        std::ofstream(session("999999997_1") / ".keep");
+        fs::create_directories(session(own_pid + "_1"));
+        fs::create_directories(root_path / "td_session_test_session_999999996_1_1");
+        fs::create_directories(root_path / "td_session_test_session_999999995_1");
+        fs::create_directories(root_path / "td_other_session_999999999_1");
+
+        REQUIRE(TempDir::reap_sessions(config) == 3);
+        REQUIRE_FALSE(fs::exists(session("999999999_1")));
+        REQUIRE_FALSE(fs::exists(session("999999998_1").concat(".removing")));
+        // a stale session of an earlier process with the pid of this process
+        REQUIRE_FALSE(fs::exists(session(own_pid + "_1")));
+        REQUIRE(fs::exists(session("999999997_1")));
+        REQUIRE(fs::exists(live));
+        // other pid namespace and names without pid namespace
+        REQUIRE(fs::exists(root_path / "td_session_test_session_999999996_1_1"));
+        REQUIRE(fs::exists(root_path / "td_session_test_session_999999995_1"));
+        REQUIRE(fs::exists(root_path / "td_other_session_999999999_1"));
+
+        fs::remove_all(session("999999997_1"));
+    }
+#endif
+
+    fs::remove_all(root_path / "td_session_test_session_999999996_1_1");
+    fs::remove_all(root_path / "td_session_test_session_999999995_1");
+    fs::remove_all(root_path / "td_other_session_999999999_1");
+}
+
+TEST_CASE("TempDir resumes persistent temporary directory")
+{
+    Config config = Config().set_temp_dir_prefix("persistent_test").set_cleanup(Cleanup::never);
+    fs::path path;
+    fs::path manifest;
+    {
+        TempDir temp_dir = TempDir::open_or_create("job 42", config);
+        path = temp_dir.path();
+        manifest = path.parent_path() / (path.filename().string() + ".manifest");
+        REQUIRE(path.filename() == "persistent_test_job_42");
+        REQUIRE_FALSE(temp_dir.resumed());
+        REQUIRE_FALSE(temp_dir.completed("step 1"));
+        REQUIRE_THROWS_AS(TempDir::open_or_create("job 42", config), TempDirException);
+
+        std::ofstream(path / "step1.dat") << "data";
+        temp_dir.mark_completed("step 1");
+        temp_dir.mark_completed("step 1");
+        REQUIRE(temp_dir.completed("step 1"));
+        REQUIRE_THROWS_AS(temp_dir.mark_completed("a\nb"), TempDirException);
+    }
+    REQUIRE(fs::exists(path / "step1.dat"));
+
+    // simulates a crash while recording an artifact
+    std::ofstream(manifest, std::ios::app) << "step 2";
+
+    {
+        TempDir temp_dir =
+            TempDir::open_or_create("job 42", Config(config).set_cleanup(Cleanup::always));
+        REQUIRE(temp_dir.path() == path);
+        REQUIRE(temp_dir.resumed());
+        REQUIRE(temp_dir.completed("step 1"));
+        REQUIRE_FALSE(temp_dir.completed("step 2"));
+        REQUIRE(temp_dir.completed_artifacts() == std::vector<std::string>{"step 1"});
+        REQUIRE(fs::exists(path / "step1.dat"));
+    }
+    REQUIRE_FALSE(fs::exists(path));
+    REQUIRE_FALSE(fs::exists(manifest));
+
+    TempDir temp_dir;
+    REQUIRE_FALSE(temp_dir.resumed());
+    REQUIRE_THROWS_AS(temp_dir.mark_completed("step"), TempDirException);
+}
+
+TEST_CASE("SharedTempDir is cleaned up by the last owner")
+{
+    SECTION("owners within a process")
+    {
+        fs::path path;
+        {
+            SharedTempDir shared;
+            path = shared.path();
+            std::vector<std::thread> stages;
+            for (int i = 0; i < 4; ++i)
+            {
+                stages.emplace_back([copy = shared, i] {
+                    std::ofstream(copy.path() / ("stage" + std::to_string(i) + ".txt")) << i;
+                });
+            }
+            for (auto& stage : stages)
+                stage.join();
+            REQUIRE(shared.use_count() == 1);
+            REQUIRE(std::distance(fs::directory_iterator(path), fs::directory_iterator()) == 4);
+        }
+        REQUIRE_FALSE(fs::exists(path));
+    }
+
+    SECTION("owners across processes")
+    {
+        fs::path path;
+        fs::path refs;
+        {
+            SharedTempDir creator = SharedTempDir::create_cross_process();
+            path = creator.path();
+            refs = path.string() + ".refs";
+            REQUIRE(fs::exists(refs));
+            {
+                SharedTempDir consumer = SharedTempDir::attach(path);
+                REQUIRE(consumer.path() == path);
+                std::ofstream(consumer.path() / "data.bin") << "data";
+            }
+            REQUIRE(fs::exists(path / "data.bin"));
+
+            SharedTempDir consumer = SharedTempDir::attach(path);
+            creator = consumer;
+        }
+        REQUIRE_FALSE(fs::exists(path));
+        REQUIRE_FALSE(fs::exists(refs));
+        REQUIRE_THROWS_AS(SharedTempDir::attach(path), TempDirException);
+    }
+}
+
+TEST_CASE("TempDir reports slow operations with call site")
+{
+    std::vector<SlowOperation> reports;
+    Config config = Config().set_slow_operation_threshold_us(
+        1, [&](const SlowOperation& operation) { reports.push_back(operation); });
+
+    fs::path path;
+    unsigned int line = 0;
+    {
+        line = __LINE__ + 1;
+        TempDir temp_dir = TempDir::create(config);
+        path = temp_dir.path();
+        REQUIRE(std::string(temp_dir.call_site().file).find("tempdir_tests.cpp") !=
+                std::string::npos);
+        REQUIRE(temp_dir.call_site().line == line);
+        temp_dir.write_files({{"a/1.txt", "1"}, {"a/2.txt", "2"}});
+        std::ofstream(path / "untracked.txt") << "content";
+    }
+
+    REQUIRE(reports.size() == 2);
+    REQUIRE(std::string(reports[0].operation) == "create");
+    REQUIRE(reports[0].path == path);
+    REQUIRE(reports[0].call_site.line == line);
+    REQUIRE(reports[0].total_us == reports[0].name_generation_us + reports[0].mkdir_us);
+
+    REQUIRE(std::string(reports[1].operation) == "cleanup");
+    REQUIRE(reports[1].call_site.line == line);
+    REQUIRE(reports[1].entries == 5);
+    REQUIRE(reports[1].removal_us >= 1);
+
+    reports.clear();
+    TempDir fast(Config(config).set_slow_operation_threshold_us(60'000'000));
+    REQUIRE(reports.empty());
+
+    // TempDirs constructed directly have no call site
+    TempDir direct(config);
+    REQUIRE(direct.call_site().line == 0);
+}
+
+TEST_CASE("TraceRecorder records operations for replay")
+{
+    TempDir trace_dir;
+    fs::path trace_file = trace_dir.path() / "operations.trace";
+    {
+        TraceRecorder recorder(trace_file);
+        Config config = Config().set_trace_recorder(&recorder);
+        TempDir temp_dir(config);
+        temp_dir.write_files({{"a/1.txt", "12"}, {"a/2.txt", "345"}});
+        temp_dir.materialize(Fixture().file("b.txt", "6789"));
+        temp_dir.list(ListOptions().set_recursive(true));
+        std::thread([&] { TempDir other(config); }).join();
+    }
+
+    auto events = TraceRecorder::read(trace_file);
+    std::vector<TraceOp> ops;
+    for (const auto& event : events)
+        ops.push_back(event.op);
+    REQUIRE(ops == std::vector<TraceOp>{TraceOp::create, TraceOp::write_files,
+                                        TraceOp::materialize, TraceOp::list, TraceOp::create,
+                                        TraceOp::cleanup, TraceOp::cleanup});
+    REQUIRE(events[1].count == 2);
+    REQUIRE(events[1].bytes == 5);
+    REQUIRE(events[2].count == 1);
+    REQUIRE(events[2].bytes == 4);
+    REQUIRE(events[4].dir != events[0].dir);
+    REQUIRE(events[4].thread != events[0].thread);
+    REQUIRE(events[6].dir == events[0].dir);
+    for (std::size_t i = 1; i < events.size(); ++i)
+        REQUIRE(events[i].timestamp_ns >= events[i - 1].timestamp_ns);
+
+    ReplayResult result =
+        replay_trace(events, ReplayOptions().set_config(Config().set_temp_dir_prefix("replay")));
+    REQUIRE(result.errors.empty());
+    REQUIRE(result.threads == 2);
+    REQUIRE(result.ops[std::size_t(TraceOp::create)].events == 2);
+    REQUIRE(result.ops[std::size_t(TraceOp::write_files)].events == 1);
+
+    std::ofstream(trace_dir.path() / "invalid.trace") << "no trace";
+    REQUIRE_THROWS_AS(TraceRecorder::read(trace_dir.path() / "invalid.trace"), TempDirException);
+
+    // an event with an operation unknown to this version
+    fs::copy_file(trace_file, trace_dir.path() / "unknown.trace");
+    std::ofstream(trace_dir.path() / "unknown.trace", std::ios::binary | std::ios::app)
+        << char(trace_op_count) << std::string(6, '\0');
+    REQUIRE_THROWS_AS(TraceRecorder::read(trace_dir.path() / "unknown.trace"), TempDirException);
+
+    TraceEvent unknown = events[0];
+    unknown.op = TraceOp(trace_op_count);
+    result = replay_trace({unknown}, ReplayOptions().set_timing(false));
+    REQUIRE(result.errors.size() == 1);
+    REQUIRE(result.ops[std::size_t(TraceOp::create)].events == 0);
+}
+
+TEST_CASE("TempDir rotates generations of the root path")
+{
+    TempDir root;
+    fs::create_directory(root.path() / "gen-3");
+    fs::create_directory(root.path() / "gen-7");
+    Config config = Config().set_root_path(root.path()).set_generation_rotation(2);
+
+    auto removed_eventually = [](const fs::path& path) {
+        for (int i = 0; i < 500 && fs::exists(path); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return !fs::exists(path);
+    };
+
+    auto first = std::make_unique<TempDir>(config);
+    auto second = std::make_unique<TempDir>(config);
+    auto third = std::make_unique<TempDir>(config);
+    REQUIRE(first->path().parent_path() == root.path() / "gen-7");
+    REQUIRE(second->path().parent_path() == root.path() / "gen-7");
+    REQUIRE(third->path().parent_path() == root.path() / "gen-8");
+
+    auto fourth = std::make_unique<TempDir>(config);
+    TempDir fifth(config);
+    REQUIRE(fourth->path().parent_path() == root.path() / "gen-8");
+    REQUIRE(fifth.path().parent_path() == root.path() / "gen-9");
+
+    third.reset();
+    REQUIRE(fs::exists(root.path() / "gen-8"));
+    fourth.reset();
+    REQUIRE(removed_eventually(root.path() / "gen-8"));
+    REQUIRE(fs::exists(root.path() / "gen-9"));
+
+    // generations this process did not create may be used by other processes
+    first.reset();
+    second.reset();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(fs::exists(root.path() / "gen-3"));
+    REQUIRE(fs::exists(root.path() / "gen-7"));
+
+    // names that do not fit into 64 bits are skipped
+    TempDir overflow_root;
+    fs::create_directory(overflow_root.path() / "gen-123456789012345678901234");
+    TempDir overflow(Config(config).set_root_path(overflow_root.path()));
+    REQUIRE(overflow.path().parent_path() == overflow_root.path() / "gen-0");
+}
+
+TEST_CASE("TempDir cleanup finishes large directories in the background")
+{
+    Config config = Config().set_cleanup_budget(60'000'000, 50);
+    std::vector<FileSpec> files;
+    std::vector<std::string> names;
+    for (int i = 0; i < 200; ++i)
+        names.push_back("dir" + std::to_string(i % 4) + "/file" + std::to_string(i));
+    for (const auto& name : names)
+        files.push_back({name, "content"});
+
+    fs::path small_path;
+    {
+        TempDir small(config);
+        small_path = small.path();
+        small.write_files({{"a/1.txt", "1"}, {"a/2.txt", "2"}});
+    }
+    REQUIRE_FALSE(fs::exists(small_path));
+    REQUIRE_FALSE(fs::exists(small_path.string() + ".removing"));
+
+    TempDir large(config);
+    fs::path large_path = large.path();
+    large.write_files(files);
+    std::ofstream(large_path / "dir0" / "untracked.txt") << "content";
+    large.cleanup();
+    REQUIRE_FALSE(fs::exists(large_path));
+
+    fs::path removing = large_path.string() + ".removing";
+    for (int i = 0; i < 500 && fs::exists(removing); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE_FALSE(fs::exists(removing));
+}
+
+TEST_CASE("TempDir cleanup strategies remove the whole tree")
+{
+    std::vector<std::string> names;
+    for (int i = 0; i < 2000; ++i)
+        names.push_back("d" + std::to_string(i % 8) + "/e" + std::to_string(i % 3) + "/f" +
+                        std::to_string(i));
+    std::vector<FileSpec> files;
+    for (const auto& name : names)
+        files.push_back({name, "content"});
+
+    for (CleanupStrategy strategy :
+         {CleanupStrategy::serial, CleanupStrategy::parallel, CleanupStrategy::deferred})
+    {
+        TempDir temp_dir(Config().set_cleanup_strategy(strategy));
+        fs::path path = temp_dir.path();
+        temp_dir.write_files(files);
+        std::ofstream(path / "d0" / "untracked.txt") << "content";
+        temp_dir.cleanup();
+        REQUIRE_FALSE(fs::exists(path));
+
+        fs::path removing = path.string() + ".removing";
+        for (int i = 0; i < 500 && fs::exists(removing); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        REQUIRE_FALSE(fs::exists(removing));
+    }
+}
+
+TEST_CASE("TempDir adaptive cleanup estimates the tree size")
+{
+    std::vector<std::string> log;
+    auto log_impl = [&](const std::string& message) { log.push_back(message); };
+    Config config =
+        Config().set_cleanup_strategy(CleanupStrategy::adaptive).enable_logging(log_impl);
+
+    auto estimate = [&](const std::vector<std::string>& names) {
+        log.clear();
+        TempDir temp_dir(config);
+        for (const auto& name : names)
+        {
+            fs::create_directories((temp_dir.path() / name).parent_path());
+            std::ofstream(temp_dir.path() / name) << "content";
+        }
+        temp_dir.cleanup();
+        REQUIRE_FALSE(fs::exists(temp_dir.path()));
+
+        for (const auto& message : log)
+        {
+            auto pos = message.find("estimated ");
+            if (pos != std::string::npos)
+                return std::stoull(message.substr(pos + 10));
+        }
+        return 0ull;
+    };
+
+    REQUIRE(estimate({"a.txt", "b.txt", "c.txt"}) == 3);
+
+    // a uniform tree of 8 x 4 directories with 8 files each, estimated exactly by any path
+    std::vector<std::string> names;
+    for (int i = 0; i < 256; ++i)
+        names.push_back("d" + std::to_string(i % 8) + "/e" + std::to_string(i / 8 % 4) + "/f" +
+                        std::to_string(i));
+    REQUIRE(estimate(names) == 256 + 32 + 8);
+}
+
+TEST_CASE("TempDir adaptive cleanup leaves no probe entries behind")
+{
+    TempDir root;
+    {
+        TempDir temp_dir(
+            Config().set_root_path(root.path()).set_cleanup_strategy(CleanupStrategy::adaptive));
+        temp_dir.write_files({{"locked/file.txt", "content"}});
+        fs::permissions(temp_dir.path() / "locked",
+                        fs::perms::owner_read | fs::perms::owner_exec);
+    }
+    for (int i = 0; i < 500 && !fs::is_empty(root.path()); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(fs::is_empty(root.path()));
+}
+
+TEST_CASE("TempDir detects container layer roots")
+{
+    TempDir temp_dir;
+    Config config = Config().set_root_path(temp_dir.path()).set_avoid_container_layer(true);
+    if (!TempDir::inspect_root(temp_dir.path()).container_layer)
+    {
+        REQUIRE(TempDir::select_root(config) == temp_dir.path());
+        TempDir nested(config);
+        REQUIRE(nested.path().parent_path() == temp_dir.path());
+    }
+
+#ifdef __linux__
+    RootInfo info = TempDir::inspect_root(temp_dir.path());
+    REQUIRE_FALSE(info.filesystem.empty());
+    REQUIRE_FALSE(info.mount_point.empty());
+
+    fs::path mountinfo = temp_dir.path() / "mountinfo";
+    std::ofstream(mountinfo)
+        << "20 1 0:50 / / rw,relatime master:1 - overlay overlay rw,lowerdir=/l,upperdir=/u\n"
+        << "21 20 0:51 / /dev/shm rw,nosuid - tmpfs shm rw\n"
+        << "22 20 8:1 /data /mnt/my\\040volume rw - ext4 /dev/sda1 rw\n"
+        << "23 20 8:2 / /mnt/my rw - xfs /dev/sda2 rw\n";
+
+    RootInfo overlay = TempDir::inspect_root("/var/tmp", mountinfo);
+    REQUIRE(overlay.filesystem == "overlay");
+    REQUIRE(overlay.mount_point == "/");
+    REQUIRE(overlay.container_layer);
+
+    RootInfo volume = TempDir::inspect_root("/mnt/my volume/cache", mountinfo);
+    REQUIRE(volume.filesystem == "ext4");
+    REQUIRE(volume.mount_point == "/mnt/my volume");
+    REQUIRE_FALSE(volume.container_layer);
+
+    REQUIRE(TempDir::inspect_root("/mnt/mysql", mountinfo).filesystem == "overlay");
+    REQUIRE(TempDir::inspect_root("/mnt/my/data", mountinfo).filesystem == "xfs");
+#endif
+}
+
+TEST_CASE("TempDir migrates contents while its path stays valid")
+{
+    TempDir ram_root;
+    TempDir disk_root;
+    Config config =
+        Config().set_root_path(ram_root.path()).set_migration_root(disk_root.path());
+
+    fs::path path;
+    {
+        TempDir temp_dir(config);
+        path = temp_dir.path();
+        temp_dir.write_files({{"a/1.txt", "1"}, {"2.txt", "2"}});
+        REQUIRE_FALSE(temp_dir.migrated());
+
+        // files may be open until the TempDir is declared quiescent
+        REQUIRE_FALSE(temp_dir.migrate());
+        REQUIRE(fs::exists(path / "a/1.txt"));
+        temp_dir.set_quiescent(true);
+        REQUIRE(temp_dir.migrate());
+        REQUIRE(temp_dir.migrated());
+        REQUIRE_FALSE(temp_dir.migrate());
+        REQUIRE(temp_dir.path() == path);
+        REQUIRE(fs::is_symlink(path));
+        REQUIRE(fs::read_symlink(path).parent_path() == disk_root.path());
+
+        std::string content;
+        std::ifstream(path / "a/1.txt") >> content;
+        REQUIRE(content == "1");
+        temp_dir.write_files({{"3.txt", "3"}});
+        REQUIRE(fs::exists(fs::read_symlink(path) / "3.txt"));
+
+        // only the symlink is left on the RAM root
+        REQUIRE(std::distance(fs::directory_iterator(ram_root.path()), {}) == 1);
+    }
+    REQUIRE_FALSE(fs::exists(fs::symlink_status(path)));
+    REQUIRE(fs::is_empty(ram_root.path()));
+    REQUIRE(fs::is_empty(disk_root.path()));
+
+    TempDir not_migratable(Config().set_root_path(ram_root.path()));
+    not_migratable.set_quiescent(true);
+    REQUIRE_FALSE(not_migratable.migrate());
+
+    // existing entries at the migration target are left untouched
+    TempDir temp_dir(config);
+    temp_dir.set_quiescent(true);
+    temp_dir.write_files({{"1.txt", "1"}});
+    fs::path existing = disk_root.path() / (temp_dir.path().filename().string() + ".d");
+    fs::create_directory(existing);
+    std::ofstream(existing / "foreign.txt") << "foreign";
+    REQUIRE_FALSE(temp_dir.migrate());
+    REQUIRE(read_file(existing / "foreign.txt") == "foreign");
+    REQUIRE(read_file(temp_dir.path() / "1.txt") == "1");
+
+    fs::remove_all(existing);
+    fs::path partial = existing.string() + ".partial";
+    fs::create_directory(partial);
+    std::ofstream(partial / "foreign.txt") << "foreign";
+    REQUIRE_FALSE(temp_dir.migrate());
+    REQUIRE(read_file(partial / "foreign.txt") == "foreign");
+    REQUIRE_FALSE(fs::exists(existing));
+    fs::remove_all(partial);
+}
+
+TEST_CASE("MemoryPressureWatcher migrates TempDirs when a threshold is crossed")
+{
+    TempDir ram_root;
+    TempDir disk_root;
+    Config config =
+        Config().set_root_path(ram_root.path()).set_migration_root(disk_root.path());
+    TempDir first(config);
+    TempDir second(config);
+    TempDir in_use(config);
+    first.write_files({{"file.txt", "content"}});
+    first.set_quiescent(true);
+    second.set_quiescent(true);
+
+    MemoryPressure pressure = MemoryPressureWatcher::sample();
+    REQUIRE(pressure.some_avg10 >= 0);
+
+    {
+        MemoryPressureWatcher watcher(MemoryPressureOptions()
+                                          .set_some_avg10(0)
+                                          .set_min_mem_available(UINT64_MAX)
+                                          .set_poll_interval_ms(10));
+        for (int i = 0; i < 500 && watcher.migrated() < 2; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (pressure.mem_available > 0)
+            REQUIRE(watcher.migrated() == 2);
+    }
+    if (pressure.mem_available > 0)
+    {
+        REQUIRE(first.migrated());
+        REQUIRE(second.migrated());
+        REQUIRE_FALSE(in_use.migrated());
+        REQUIRE(fs::exists(first.path() / "file.txt"));
+    }
+}
+
+namespace
+{
+// log-like text, compressible but not trivially
+std::string scratch_text(std::size_t size)
+{
+    static const char* levels[] = {"INFO", "WARN", "DEBUG"};
+    std::mt19937 random(42);
+    std::string text;
+    while (text.size() < size)
+        text += "2024-05-01T12:00:" + std::to_string(random() % 60) + " " + levels[random() % 3] +
+                " request " + std::to_string(random() % 100000) + " completed\n";
+    text.resize(size);
+    return text;
+}
+} // namespace
+
+TEST_CASE("Scratch files round trip compressed blocks")
+{
+    TempDir temp_dir;
+    std::string text = scratch_text(1'000'000);
+    {
+        ScratchWriter writer(temp_dir, "spill.tds",
+                             ScratchOptions().set_block_size(16 * 1024).set_threads(4));
+        writer.write(std::string_view(text).substr(0, 1000));
+        writer.write(std::string_view(text).substr(1000));
+        writer.close();
+        REQUIRE(writer.raw_size() == text.size());
+        REQUIRE(writer.block_count() == (text.size() + 16 * 1024 - 1) / (16 * 1024));
+        REQUIRE(writer.stored_blocks() == 0);
+        REQUIRE(writer.file_size() < text.size() / 2);
+        REQUIRE(writer.file_size() == fs::file_size(temp_dir.path() / "spill.tds"));
+    }
+
+    ScratchReader reader(temp_dir.path() / "spill.tds");
+    REQUIRE(reader.size() == text.size());
+    REQUIRE(reader.block_size() == 16 * 1024);
+    REQUIRE(reader.read_all() == text);
+
+    // long runs are encoded as overlapping matches
+    std::string run(100'000, 'a');
+    ScratchWriter(temp_dir, "run.tds").write(run);
+    REQUIRE(ScratchReader(temp_dir.path() / "run.tds").read_all() == run);
+
+    ScratchWriter(temp_dir, "empty.tds");
+    ScratchReader empty(temp_dir.path() / "empty.tds");
+    REQUIRE(empty.block_count() == 0);
+    REQUIRE(empty.read_all().empty());
+}
+
+TEST_CASE("Scratch files store incompressible blocks as-is")
+{
+    TempDir temp_dir;
+    std::mt19937 random(7);
+    std::string noise(300'000, '\0');
+    for (auto& c : noise)
+        c = static_cast<char>(random());
+    std::string text = scratch_text(300'000);
+
+    ScratchWriter writer(temp_dir, "mixed.tds", ScratchOptions().set_block_size(10'000));
+    writer.write(noise);
+    writer.write(text);
+    writer.close();
+    REQUIRE(writer.block_count() == 60);
+    REQUIRE(writer.stored_blocks() >= 30);
+    REQUIRE(writer.stored_blocks() < 45); // compressible data is detected again by probing
+    REQUIRE(ScratchReader(temp_dir.path() / "mixed.tds").read_all() == noise + text);
+
+    ScratchWriter plain(temp_dir, "plain.tds", ScratchOptions().set_compression(false));
+    plain.write(text);
+    plain.close();
+    REQUIRE(plain.stored_blocks() == plain.block_count());
+    REQUIRE(ScratchReader(temp_dir.path() / "plain.tds").read_all() == text);
+}
+
+TEST_CASE("Scratch files support random access by block index")
+{
+    TempDir temp_dir;
+    std::string text = scratch_text(200'000);
+    ScratchWriter(temp_dir, "spill.tds", ScratchOptions().set_block_size(4096)).write(text);
+
+    ScratchReader reader(temp_dir.path() / "spill.tds");
+    REQUIRE(reader.block_count() == 49);
+    REQUIRE(reader.read_block(30) == text.substr(30 * 4096, 4096));
+    REQUIRE(reader.read_block(48) == text.substr(48 * 4096));
+    REQUIRE(reader.read_block(2) == text.substr(2 * 4096, 4096));
+    REQUIRE_THROWS_AS(reader.read_block(49), TempDirException);
+
+    std::string buffer(10'000, '\0');
+    reader.seek(12'345);
+    REQUIRE(reader.read(buffer.data(), buffer.size()) == buffer.size());
+    REQUIRE(buffer == text.substr(12'345, 10'000));
+    REQUIRE(reader.tell() == 22'345);
+    reader.seek(text.size() - 100);
+    REQUIRE(reader.read(buffer.data(), buffer.size()) == 100);
+}
+
+TEST_CASE("Scratch readers reject malformed files")
+{
+    TempDir temp_dir;
+    fs::path path = temp_dir.path() / "spill.tds";
+    std::string text = scratch_text(100'000);
+    ScratchWriter(path, ScratchOptions().set_block_size(8192)).write(text);
+    std::string contents;
+    {
+        std::ifstream file(path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(file), {});
+    }
+
+    std::ofstream(temp_dir.path() / "text.txt") << text;
+    REQUIRE_THROWS_AS(ScratchReader(temp_dir.path() / "text.txt"), TempDirException);
+    REQUIRE_THROWS_AS(ScratchReader(temp_dir.path() / "missing.tds"), TempDirException);
+
+    std::ofstream(path, std::ios::binary) << contents.substr(0, contents.size() - 10);
+    REQUIRE_THROWS_AS(ScratchReader(path), TempDirException);
+
+    // block sizes beyond the writer's limit are rejected before any block is allocated
+    fs::path single = temp_dir.path() / "single.tds";
+    ScratchWriter(single).write(text.substr(0, 1000));
+    std::string oversized;
+    {
+        std::ifstream file(single, std::ios::binary);
+        oversized.assign(std::istreambuf_iterator<char>(file), {});
+    }
+    oversized.replace(8, 4, "\xff\xff\xff\xff");
+    std::ofstream(single, std::ios::binary) << oversized;
+    REQUIRE_THROWS_AS(ScratchReader(single), TempDirException);
+
+    // a corrupted block length is detected when the block is read
+    std::string corrupted = contents;
+    corrupted[detail::scratch_header_size + 4] ^= 0x10;
+    std::ofstream(path, std::ios::binary) << corrupted;
+    ScratchReader reader(path);
+    REQUIRE(reader.read_block(1) == text.substr(8192, 8192));
+    REQUIRE_THROWS_AS(reader.read_block(0), TempDirException);
+}
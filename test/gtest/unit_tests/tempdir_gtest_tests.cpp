@@ -0,0 +1,46 @@
+// TempDir
+// SPDX-FileCopyrightText: 2024-present Benno Waldhauer
+// SPDX-License-Identifier: MIT
+
+#include <bw/tempdir/tempdir_gtest.hpp>
+#include <fstream>
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+using namespace bw::tempdir;
+
+namespace
+{
+fs::path previous_dir;
+}
+
+class TempDirGTest : public gtest::TempDirTest
+{
+};
+
+TEST_F(TempDirGTest, ProvidesDirectory)
+{
+    ASSERT_TRUE(fs::is_directory(temp_dir()));
+    EXPECT_EQ(temp_dir().filename().string().rfind("TempDirGTest.ProvidesDirectory_", 0), 0u);
+    EXPECT_EQ(temp_dir().parent_path().filename().string().rfind("gtest_shard", 0), 0u);
+
+    std::ofstream(temp_dir() / "file.txt") << "content";
+    previous_dir = temp_dir();
+}
+
+TEST_F(TempDirGTest, RecyclesDirectory)
+{
+    if (previous_dir.empty())
+        GTEST_SKIP() << "ProvidesDirectory did not run in this shard";
+
+    EXPECT_FALSE(fs::exists(previous_dir));
+    EXPECT_EQ(temp_dir().parent_path(), previous_dir.parent_path());
+    EXPECT_TRUE(fs::is_empty(temp_dir()));
+}
+
+TEST(TempDirEnvironmentTest, OwnsPool)
+{
+    TempDirPool& pool = gtest::TempDirEnvironment::instance().pool();
+    EXPECT_TRUE(fs::is_directory(pool.root()));
+    EXPECT_GT(pool.available(), 0u);
+}
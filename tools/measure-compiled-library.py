@@ -0,0 +1,87 @@
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+# Compares header-only and compiled library mode of TempDir regarding
+# compile time of a translation unit including tempdir.hpp and startup time
+# of an executable built from many such translation units.
+#
+# usage: python tools/measure-compiled-library.py [compiler] [translation units] [runs]
+
+tools_dir = os.path.dirname(os.path.abspath(__file__))
+base_dir = os.path.dirname(tools_dir)
+include_dir = os.path.join(base_dir, "include")
+library_source = os.path.join(base_dir, "src", "tempdir.cpp")
+
+compiler = sys.argv[1] if len(sys.argv) > 1 else "g++"
+unit_count = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+runs = int(sys.argv[3]) if len(sys.argv) > 3 else 50
+
+unit_source = """#include <bw/tempdir/tempdir.hpp>
+const char* unit_{index}(const bw::tempdir::TempDir& temp_dir)
+{{
+    return temp_dir.path().c_str();
+}}
+"""
+
+main_source = """#include <cstdio>
+int main() { std::puts("started"); return 0; }
+"""
+
+
+def compile_object(source, output, defines):
+    command = [compiler, "-std=c++17", "-O2", "-I", include_dir, "-c", source, "-o", output]
+    command += ["-D" + define for define in defines]
+    subprocess.check_call(command)
+
+
+def measure(mode, defines, work_dir):
+    mode_dir = os.path.join(work_dir, mode)
+    os.makedirs(mode_dir)
+
+    objects = []
+    compile_times = []
+    for index in range(unit_count):
+        source = os.path.join(mode_dir, f"unit_{index}.cpp")
+        with open(source, "w") as file:
+            file.write(unit_source.format(index=index))
+        objects.append(source + ".o")
+        start = time.perf_counter()
+        compile_object(source, objects[-1], defines)
+        compile_times.append(time.perf_counter() - start)
+
+    main = os.path.join(mode_dir, "main.cpp")
+    with open(main, "w") as file:
+        file.write(main_source)
+    objects.append(main + ".o")
+    compile_object(main, objects[-1], defines)
+
+    if "TD_COMPILED_LIBRARY" in defines:
+        objects.append(os.path.join(mode_dir, "tempdir.o"))
+        compile_object(library_source, objects[-1], defines)
+
+    executable = os.path.join(mode_dir, "startup")
+    subprocess.check_call([compiler] + objects + ["-o", executable, "-pthread"])
+
+    startup_times = []
+    for _ in range(runs):
+        start = time.perf_counter()
+        subprocess.check_call([executable], stdout=subprocess.DEVNULL)
+        startup_times.append(time.perf_counter() - start)
+
+    return statistics.mean(compile_times), statistics.median(startup_times)
+
+
+work_dir = tempfile.mkdtemp(prefix="tempdir_measure_")
+try:
+    print(f"compiler: {compiler}, translation units: {unit_count}, runs: {runs}")
+    print(f"{'mode':<16}{'compile time per TU':>22}{'startup time (median)':>24}")
+    for mode, defines in [("header-only", []), ("compiled", ["TD_COMPILED_LIBRARY"])]:
+        compile_time, startup_time = measure(mode, defines, work_dir)
+        print(f"{mode:<16}{compile_time * 1000:>19.1f} ms{startup_time * 1000:>21.2f} ms")
+finally:
+    shutil.rmtree(work_dir)